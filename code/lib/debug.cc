@@ -14,19 +14,45 @@
 //----------------------------------------------------------------------
 // Debug::Debug
 //      Initialize so that only DEBUG messages with a flag in flagList 
-//	will be printed.
+//	will be printed, and only TRACE events with a flag in traceList
+//	will be recorded.
 //
-//	If the flag is "+", we enable all DEBUG messages.
+//	If the flag is "+", we enable all DEBUG messages (or TRACE events).
 //
 // 	"flagList" is a string of characters for whose DEBUG messages are 
 //		to be enabled.
+//	"traceList" is a string of characters for whose TRACE events
+//		are to be recorded.
 //----------------------------------------------------------------------
 
-Debug::Debug(char *flagList)
+Debug::Debug(char *flagList, char *traceList)
 {
     enableFlags = flagList;
+    for (int i = 0; i < 128; i++) {
+	enabled[i] = (flagList != NULL)
+		&& (strchr(flagList, i) != 0 || strchr(flagList, '+') != 0);
+	tracing[i] = (traceList != NULL)
+		&& (strchr(traceList, i) != 0 || strchr(traceList, '+') != 0);
+    }
+    enabled[0] = tracing[0] = FALSE;	// strchr always finds the NUL
+    traceBuffer = NULL;
+    if (traceList != NULL) {
+	traceBuffer = new TraceRecord[TraceBufferSize];
+    }
+    traceNext = 0;
+    traceCount = 0;
 }
 
+//----------------------------------------------------------------------
+// Debug::~Debug
+//      Print whatever is left in the trace buffer.
+//----------------------------------------------------------------------
+
+Debug::~Debug()
+{
+    DumpTrace();
+    delete [] traceBuffer;
+}
 
 //----------------------------------------------------------------------
 // Debug::IsEnabled
@@ -36,10 +62,63 @@ Debug::Debug(char *flagList)
 bool
 Debug::IsEnabled(char flag)
 {
-    if (enableFlags != NULL) {
-	return ((strchr(enableFlags, flag) != 0) 
-		|| (strchr(enableFlags, '+') != 0));
-    } else {
-    	return FALSE;
+    return enabled[flag & 0x7f];
+}
+
+//----------------------------------------------------------------------
+// Debug::Trace
+//      Record an event in the trace buffer, overwriting the oldest
+//	one if the buffer is full.  Called through the TRACE macro.
+//
+//	"flag" -- the category the event belongs to
+//	"format" -- printf format used to print the arguments when
+//		the buffer is dumped
+//	"a", "b", "c" -- integer arguments for "format"
+//----------------------------------------------------------------------
+
+void
+Debug::Trace(char flag, const char *format, int a, int b, int c)
+{
+    TraceRecord *rec = &traceBuffer[traceNext];
+
+    rec->format = format;
+    rec->flag = flag;
+    rec->arg[0] = a;
+    rec->arg[1] = b;
+    rec->arg[2] = c;
+    traceNext = (traceNext + 1) % TraceBufferSize;
+    traceCount++;
+}
+
+//----------------------------------------------------------------------
+// Debug::DumpTrace
+//      Print the events in the trace buffer, oldest first, and empty
+//	it.  Events that were overwritten are only counted.
+//----------------------------------------------------------------------
+
+void
+Debug::DumpTrace()
+{
+    char line[200];
+    int n, first;
+
+    if (traceCount == 0) {
+	return;
+    }
+    n = (traceCount < (unsigned) TraceBufferSize) ? traceCount
+						  : TraceBufferSize;
+    first = (traceNext - n + TraceBufferSize) % TraceBufferSize;
+    cerr << "Trace: " << traceCount << " events";
+    if (traceCount > (unsigned) n) {
+	cerr << ", oldest " << traceCount - n << " lost";
+    }
+    cerr << "\n";
+    for (int i = 0; i < n; i++) {
+	TraceRecord *rec = &traceBuffer[(first + i) % TraceBufferSize];
+	snprintf(line, sizeof(line), rec->format,
+			rec->arg[0], rec->arg[1], rec->arg[2]);
+	cerr << rec->flag << ": " << line << "\n";
     }
+    traceNext = 0;
+    traceCount = 0;
 }
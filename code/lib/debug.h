@@ -29,15 +29,56 @@ const char dbgFile = 'f'; 		// file system
 const char dbgAddr = 'a'; 		// address spaces
 const char dbgNet = 'n'; 		// network emulation
 const char dbgSys = 'u';                // systemcall
+const char dbgVm = 'v';			// paging and frame replacement
+
+// The trace levels.  Each TRACE names the level of detail it belongs
+// to; those above TRACE_LEVEL are compiled out altogether, so that
+// building with -DTRACE_LEVEL=0 removes all tracing from the kernel.
+
+const int TraceEvents = 1;		// page faults, evictions, switches
+const int TraceAccesses = 2;		// every memory access/translation
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL TraceEvents
+#endif
+
+// One event recorded in the trace buffer.  Records are kept in binary
+// form and only formatted when the buffer is dumped, so "format" must
+// be a string literal (or otherwise outlive the trace).
+
+class TraceRecord {
+  public:
+    const char *format;		// printf format for the arguments
+    char flag;			// the category it was traced under
+    int arg[3];			// integer arguments to format
+};
+
+const int TraceBufferSize = 4096;	// records kept before the oldest
+					// are overwritten
 
 class Debug {
   public:
-    Debug(char *flagList);
+    Debug(char *flagList, char *traceList = NULL);
+    ~Debug();
 
     bool IsEnabled(char flag);
 
+    bool IsTracing(char flag) { return tracing[flag & 0x7f]; }
+				// Is "flag" being recorded in the
+				// trace buffer?
+    void Trace(char flag, const char *format, int a = 0, int b = 0,
+		int c = 0);	// Record an event in the trace buffer
+    void DumpTrace();		// Print the trace buffer, oldest first,
+				// and empty it
+
   private:
     char *enableFlags;		// controls which DEBUG messages are printed
+    bool enabled[128];		// flag -> are its DEBUG messages printed?
+    bool tracing[128];		// flag -> are its TRACE events recorded?
+
+    TraceRecord *traceBuffer;	// ring buffer of recorded events
+    int traceNext;		// where the next event goes
+    unsigned int traceCount;	// events recorded since the last dump
 };
 
 extern Debug *debug;
@@ -53,6 +94,22 @@ extern Debug *debug;
     }
 
 
+//----------------------------------------------------------------------
+// TRACE
+//      If "flag" is being traced, record an event with up to three
+//	integer arguments in the trace buffer, e.g.
+//
+//	    TRACE(dbgVm, TraceEvents, "evict frame %d (vpn %d)", phy, vir);
+//
+//	Unlike DEBUG nothing is formatted or printed at the time; and
+//	if "level" is above TRACE_LEVEL the whole statement is compiled
+//	away.
+//----------------------------------------------------------------------
+#define TRACE(flag,level,...)                                           \
+    if ((level) > TRACE_LEVEL || !debug->IsTracing(flag)) {} else {	\
+        debug->Trace(flag, __VA_ARGS__);				\
+    }
+
 //----------------------------------------------------------------------
 // ASSERT
 //      If condition is false,  print a message and dump core.
@@ -25,7 +25,12 @@
 
 const int MagicNumber = 0x456789ab;
 const int MagicSize = sizeof(int);
-const int DiskSize = (MagicSize + (NumSectors * SectorSize));
+#define DiskSize (MagicSize + (NumSectors * SectorSize))
+
+// The disk geometry; see disk.h.
+
+int SectorsPerTrack = 32;
+int NumTracks = 32;
 
 
 //----------------------------------------------------------------------
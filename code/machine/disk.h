@@ -47,10 +47,16 @@
 //
 // The track buffer simulation can be disabled by compiling with -DNOTRACKBUF
 
+//
+// The sector size is fixed, because the file system lays out its on-disk
+// structures in whole sectors.  The disk geometry is part of the machine
+// profile and can be changed at startup (a disk file created with one
+// geometry should then be reformatted).
+
 const int SectorSize = 128;		// number of bytes per disk sector
-const int SectorsPerTrack  = 32;	// number of sectors per disk track 
-const int NumTracks = 32;		// number of tracks per disk
-const int NumSectors = (SectorsPerTrack * NumTracks);
+extern int SectorsPerTrack;		// number of sectors per disk track 
+extern int NumTracks;			// number of tracks per disk
+#define NumSectors (SectorsPerTrack * NumTracks)
 					// total # of sectors per disk
 
 class Disk : public CallBackObj {
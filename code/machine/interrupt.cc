@@ -29,7 +29,7 @@
 static char *intLevelNames[] = { "off", "on"};
 static char *intTypeNames[] = { "timer", "disk", "console write", 
 			"console read", "network send", 
-			"network recv"};
+			"network recv", "checkpoint", "swap"};
 
 //----------------------------------------------------------------------
 // PendingInterrupt::PendingInterrupt
@@ -175,6 +175,33 @@ Interrupt::OneTick()
     }
 }
 
+//----------------------------------------------------------------------
+// Interrupt::InstructionsUntilDue
+// 	Return how many user instructions can be executed, each advancing
+//	simulated time by UserTick, until the next pending interrupt is
+//	due.  Only the last of these (the one whose OneTick will fire the
+//	interrupt) needs to call OneTick; before it, OneTick would find
+//	nothing to do.  Always at least 1.
+//
+//	This only holds as long as nothing new is scheduled, so callers
+//	must start over whenever the kernel gets control (on any trap).
+//----------------------------------------------------------------------
+
+int
+Interrupt::InstructionsUntilDue()
+{
+    int ticks;
+
+    if (pending->IsEmpty()) {
+	return MaxBatch;
+    }
+    ticks = pending->Front()->when - kernel->stats->totalTicks;
+    if (ticks <= UserTick) {
+	return 1;
+    }
+    return min(divRoundUp(ticks, UserTick), MaxBatch);
+}
+
 //----------------------------------------------------------------------
 // Interrupt::YieldOnReturn
 // 	Called from within an interrupt handler, to cause a context switch
@@ -228,12 +255,14 @@ Interrupt::Idle()
 
 //----------------------------------------------------------------------
 // Interrupt::Halt
-// 	Shut down Nachos cleanly, printing out performance statistics.
+// 	Shut down Nachos cleanly, printing out the trace buffer and
+//	performance statistics.
 //----------------------------------------------------------------------
 void
 Interrupt::Halt()
 {
     cout << "Machine halting!\n\n";
+    debug->DumpTrace();
     kernel->stats->Print();
     delete kernel;	// Never returns.
 }
@@ -349,3 +378,103 @@ Interrupt::DumpState()
     pending->Apply(PrintPending);
     cout << "\nEnd of pending interrupts\n";
 }
+
+//----------------------------------------------------------------------
+// Interrupt::CanCheckpoint
+// 	Return TRUE if the pending interrupts can be saved in a
+//	checkpoint.  Only the time of each interrupt is saved, and on
+//	restore it is given to the interrupt of the same type that the
+//	new devices have scheduled, so this only works for the interrupts
+//	every device schedules for itself (timer, console and network
+//	polling).  A disk transfer, swap transfer, console write or packet
+//	send in progress cannot be recreated.
+//----------------------------------------------------------------------
+
+bool
+Interrupt::CanCheckpoint()
+{
+    ListIterator<PendingInterrupt *> iter(pending);
+
+    for (; !iter.IsDone(); iter.Next()) {
+	IntType type = iter.Item()->type;
+	if (type == DiskInt || type == SwapInt || type == ConsoleWriteInt
+		|| type == NetworkSendInt) {
+	    return FALSE;
+	}
+    }
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Interrupt::Checkpoint
+// 	Write the type and time of each pending interrupt to the open
+//	checkpoint file "fd".  The device objects to call are not saved;
+//	see CanCheckpoint.
+//----------------------------------------------------------------------
+
+void
+Interrupt::Checkpoint(int fd)
+{
+    ListIterator<PendingInterrupt *> iter(pending);
+    int count = pending->NumInList();
+
+    ASSERT(CanCheckpoint());
+    WriteFile(fd, (char *) &count, sizeof(int));
+    for (; !iter.IsDone(); iter.Next()) {
+	int saved[2];
+
+	saved[0] = iter.Item()->type;
+	saved[1] = iter.Item()->when;
+	WriteFile(fd, (char *) saved, sizeof(saved));
+    }
+}
+
+//----------------------------------------------------------------------
+// Interrupt::Restore
+// 	Read the pending interrupts written by Checkpoint, and move each
+//	interrupt the new devices have scheduled to the saved time of
+//	one of the same type.  Interrupts with no saved counterpart keep
+//	their delay, counted from the restored time.
+//
+//	Statistics must have been restored first.
+//----------------------------------------------------------------------
+
+void
+Interrupt::Restore(int fd)
+{
+    List<PendingInterrupt *> *live = new List<PendingInterrupt *>;
+    int count, *saved;
+    bool *used;
+    int i;
+
+    Read(fd, (char *) &count, sizeof(int));
+    saved = new int[2 * count];
+    used = new bool[count];
+    Read(fd, (char *) saved, 2 * count * sizeof(int));
+    for (i = 0; i < count; i++) {
+	used[i] = FALSE;
+    }
+
+    while (!pending->IsEmpty()) {
+	live->Append(pending->RemoveFront());
+    }
+    while (!live->IsEmpty()) {
+	PendingInterrupt *p = live->RemoveFront();
+
+	for (i = 0; i < count; i++) {
+	    if (!used[i] && saved[2 * i] == p->type) {
+		break;
+	    }
+	}
+	if (i < count) {
+	    p->when = saved[2 * i + 1];
+	    used[i] = TRUE;
+	} else {
+	    p->when += kernel->stats->totalTicks;
+	}
+	pending->Insert(p);
+    }
+    delete live;
+    delete [] saved;
+    delete [] used;
+}
@@ -49,7 +49,12 @@ enum MachineStatus {IdleMode, SystemMode, UserMode};
 // In Nachos, we support a hardware timer device, a disk, a console
 // display and keyboard, and a network.
 enum IntType { TimerInt, DiskInt, ConsoleWriteInt, ConsoleReadInt, 
-			NetworkSendInt, NetworkRecvInt};
+			NetworkSendInt, NetworkRecvInt, CheckpointInt,
+			SwapInt};
+
+// The most user instructions run between two calls to OneTick, when
+// there are no pending interrupts to bound the batch.
+const int MaxBatch = 1 << 20;
 
 // The following class defines an interrupt that is scheduled
 // to occur in the future.  The internal data structures are
@@ -102,6 +107,12 @@ class Interrupt {
         			// idle, kernel, user
 
     void DumpState();		// Print interrupt state
+
+    bool CanCheckpoint();	// Is there no device operation in
+				// progress that a checkpoint would lose?
+    void Checkpoint(int fd);	// Write the pending interrupts to a
+    void Restore(int fd);	// checkpoint, or retime the devices'
+				// interrupts to match one
     
 
     // NOTE: the following are internal to the hardware simulation code.
@@ -116,6 +127,9 @@ class Interrupt {
     
     void OneTick();       	// Advance simulated time
 
+    int InstructionsUntilDue();	// How many user instructions can run
+    				// before the next interrupt is due
+
   private:
     IntStatus level;		// are interrupts enabled or disabled?
     SortedList<PendingInterrupt *> *pending;		
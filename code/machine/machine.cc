@@ -14,9 +14,19 @@
 // Textual names of the exceptions that can be generated by user program
 // execution, for debugging.
 static char *exceptionNames[] = {"no exception", "syscall",
-                                 "page fault/no TLB entry", "page read only",
+                                 "page fault", "page read only",
                                  "bus error", "address error", "overflow",
-                                 "illegal instruction"};
+                                 "illegal instruction", "TLB miss"};
+
+// The size of user memory; see machine.h.  You are allowed to change
+// these defaults, or to override them at startup with -M or -P.
+
+int PageSize = 128;
+int NumPhysPages = 128;
+int TLBSize = 4;
+int TLBWays = 4;
+int HandSpread = 16;
+int WorkingSetWindow = 10000;
 
 //----------------------------------------------------------------------
 // CheckEndian
@@ -49,9 +59,12 @@ void CheckEndian() {
 //
 //	"debug" -- if TRUE, drop into the debugger after each user instruction
 //		is executed.
+//	"whichEngine" -- how user instructions are to be executed
+//	"whichPolicy" -- how to choose the frame to evict
 //----------------------------------------------------------------------
 
-Machine::Machine(bool debug) {
+Machine::Machine(bool debug, ExecEngine whichEngine,
+                 ReplacementPolicy whichPolicy) {
     int i;
 
     for (i = 0; i < NumTotalRegs; i++)
@@ -60,6 +73,7 @@ Machine::Machine(bool debug) {
     for (i = 0; i < MemorySize; i++)
         mainMemory[i] = 0;
 #ifdef USE_TLB
+    ASSERT(TLBWays > 0 && TLBSize % TLBWays == 0);
     tlb = new TranslationEntry[TLBSize];
     for (i = 0; i < TLBSize; i++)
     tlb[i].valid = FALSE;
@@ -68,11 +82,40 @@ Machine::Machine(bool debug) {
     tlb = NULL;
     pageTable = NULL;
 #endif
+    asid = 0;
 
     cout << "initializing free frames!" << endl;
     //初始化全局页表
     GlobalPageTable = new GlobalEntry[NumPhysPages];
+    freeFrames = new FrameList(NumPhysPages);
+    lruFrames = new FrameList(NumPhysPages);
+    for (i = 0; i < NumPhysPages; i++)
+        freeFrames->Append(i);
+    decodedPages = new Instruction *[NumPhysPages];
+    for (i = 0; i < NumPhysPages; i++)
+        decodedPages[i] = NULL;
+    dispatchTable = NULL;
+    frameGeneration = new int[NumPhysPages];
+    for (i = 0; i < NumPhysPages; i++)
+        frameGeneration[i] = 0;
+    blockTable = new CodeBlock *[BlockTableSize];
+    for (i = 0; i < BlockTableSize; i++)
+        blockTable[i] = NULL;
+    numTraps = 0;
+    for (i = 0; i < NumPerfCounters; i++)
+        perfCounters[i] = 0;
+    fastTLB = new FastTranslation[FastTLBSize];
+    for (i = 0; i < FastTLBSize; i++) {
+        fastTLB[i].space = NULL;
+        fastTLB[i].vpn = NoFastVpn;
+        fastTLB[i].hits = 0;
+    }
+    engine = whichEngine;
+    replacement = whichPolicy;
+    victimOwner = NULL;
+    clockHand = 0;
     singleStep = debug;
+    traceInstructions = ::debug->IsEnabled(dbgMach);
     CheckEndian();
 }
 
@@ -84,6 +127,22 @@ Machine::Machine(bool debug) {
 Machine::~Machine() {
     delete[] mainMemory;
     delete[] GlobalPageTable;
+    delete freeFrames;
+    delete lruFrames;
+    for (int i = 0; i < NumPhysPages; i++)
+        delete[] decodedPages[i];
+    delete[] decodedPages;
+    delete[] frameGeneration;
+    for (int i = 0; i < BlockTableSize; i++) {
+        while (blockTable[i] != NULL) {
+            CodeBlock *block = blockTable[i];
+            blockTable[i] = block->next;
+            delete[] block->code;
+            delete block;
+        }
+    }
+    delete[] blockTable;
+    delete[] fastTLB;
     if (tlb != NULL)
         delete[] tlb;
 }
@@ -103,11 +162,44 @@ Machine::RaiseException(ExceptionType which, int badVAddr) {
     DEBUG(dbgMach, "Exception: " << exceptionNames[which]);
     //cout << "raising exception " << which << " at " << badVAddr << endl; 
 
+    int loads, stores;
+
+    numTraps++;
+    if (which == SyscallException)
+        perfCounters[PerfSyscalls]++;
+    else if (which == TLBMissException)
+        perfCounters[PerfTLBMisses]++;
+    else if (which == PageFaultException)
+        perfCounters[PerfPageFaults]++;
+    // the kernel's own accesses to user memory are not counted
+    loads = perfCounters[PerfLoads];
+    stores = perfCounters[PerfStores];
+
     registers[BadVAddrReg] = badVAddr;
     DelayedLoad(0, 0);            // finish anything in progress
     kernel->interrupt->setStatus(SystemMode);
     ExceptionHandler(which);        // interrupts are enabled at this point
     kernel->interrupt->setStatus(UserMode);
+
+    perfCounters[PerfLoads] = loads;
+    perfCounters[PerfStores] = stores;
+}
+
+//----------------------------------------------------------------------
+// Machine::ReadCounter
+// 	Return the value of the performance counter "which".  The user
+//	and system ticks are the ones Interrupt::OneTick (and Run, for
+//	batches of user instructions) keep in the Statistics.
+//----------------------------------------------------------------------
+
+int
+Machine::ReadCounter(PerfCounterType which) {
+    ASSERT(which >= 0 && which < NumPerfCounters);
+    if (which == PerfUserTicks)
+        return kernel->stats->userTicks;
+    if (which == PerfSystemTicks)
+        return kernel->stats->systemTicks;
+    return perfCounters[which];
 }
 
 //----------------------------------------------------------------------
@@ -220,32 +312,376 @@ Machine::WriteRegister(int num, int value) {
 }
 
 int Machine::findFreeByLRU() {
-    int mi = 0;
-    for (int i = 0; i < NumPhysPages; i++) {
-        ASSERT(GlobalPageTable[i].RefPageTable != NULL);
-        // 比较时间戳
-        if (GlobalPageTable[i].useStamp < GlobalPageTable[mi].useStamp)
-            mi = i;
+    int i;
+    SyncUseStamps();    // 先把快速翻译缓存中累计的访问计入LRU链表
+    // LRU链表头部是最久未使用的物理页
+    for (i = lruFrames->First(); i != -1; i = lruFrames->Next(i)) {
+        kernel->stats->numFramesScanned++;
+        // 空闲的页、正在换入换出的页不能换出
+        if (Candidate(i))
+            break;
+    }
+    return i;           // 所有物理页都不能换出时为-1
+}
+
+// 寻找物理内存内的空闲Frame（空闲链表的头部），若没有则返回-1
+int Machine::findFreeFrame(int virAddr, PageTable *ref) {
+    int i = freeFrames->First();
+
+    if (i == -1) {
+        TRACE(dbgVm, TraceEvents, "no free frame for vpn %d", virAddr);
+        return -1;
+    }
+    TRACE(dbgVm, TraceEvents, "free frame %d for vpn %d", i, virAddr);
+    // 找到可用的空闲frame后，更新全局的页表
+    UseFrame(i, virAddr, ref);
+    // 新的内容将被写入该物理页，旧的译码缓存失效
+    InvalidateDecodedPage(i);
+    return i;
+}
+
+//----------------------------------------------------------------------
+// Machine::UseFrame
+// 	Record in the global page table that "frame", either free or
+//	just taken from its previous users (who are forgotten when the
+//	page is evicted), now holds virtual page "vpn" of page table
+//	"ref", and no one else's: it goes to the tail of the LRU list as
+//	the most recently used frame.
+//----------------------------------------------------------------------
+
+void
+Machine::UseFrame(int frame, int vpn, PageTable *ref) {
+    GlobalEntry *global = &GlobalPageTable[frame];
+
+    ASSERT(global->sharers == NULL && global->RefPageTable == NULL);
+    ref->resident++;
+    global->VirNum = vpn;
+    global->RefPageTable = ref;
+    global->refCount = 1;
+    global->sharedText = FALSE;
+    global->busy = FALSE;
+    global->useStamp = 0;
+    global->lastUse = kernel->stats->totalTicks;
+    if (freeFrames->IsMember(frame))
+        freeFrames->Remove(frame);
+    if (lruFrames->IsMember(frame))
+        lruFrames->Remove(frame);
+    lruFrames->Append(frame);
+}
+
+//----------------------------------------------------------------------
+// Machine::FreeFrame
+// 	The only user of "frame" no longer maps it, or it has just been
+//	evicted: forget the page in the global page table, and put the
+//	frame on the free list.
+//----------------------------------------------------------------------
+
+void
+Machine::FreeFrame(int frame) {
+    GlobalEntry *global = &GlobalPageTable[frame];
+
+    ASSERT(global->refCount == 1 && global->sharers == NULL && !global->busy);
+    if (global->RefPageTable != NULL)   // not already evicted
+        global->RefPageTable->resident--;
+    global->RefPageTable = NULL;
+    global->VirNum = -1;
+    global->refCount = 0;
+    global->sharedText = FALSE;
+    lruFrames->Remove(frame);
+    freeFrames->Append(frame);
+}
+
+//----------------------------------------------------------------------
+// Machine::FindVictim
+// 	Choose the frame to evict, with the replacement policy chosen at
+//	startup, and count how many frames it had to look at to find it.
+//	Return -1 if no frame can be evicted: all are free or busy with
+//	a transfer.
+//
+//	If "owner" is not NULL, only frames held by that page table are
+//	considered, for a process replacing its own pages.
+//----------------------------------------------------------------------
+
+int
+Machine::FindVictim(PageTable *owner) {
+    int frame;
+    int start = kernel->stats->numFramesScanned;
+
+    victimOwner = owner;
+    switch (replacement) {
+        case LRUReplacement:
+            frame = findFreeByLRU();
+            break;
+        case ClockReplacement:
+            frame = ClockVictim();
+            break;
+        case TwoHandClockReplacement:
+            frame = TwoHandClockVictim();
+            break;
+        case WSClockReplacement:
+            frame = WSClockVictim();
+            break;
+        default:
+            ASSERTNOTREACHED();
     }
-    return mi;
+    victimOwner = NULL;
+    if (frame == -1)
+        return -1;
+    kernel->stats->numEvictions++;
+    TRACE(dbgVm, TraceEvents, "victim frame %d after scanning %d frames",
+          frame, kernel->stats->numFramesScanned - start);
+    return frame;
 }
 
-// 寻找物理内存内的空闲Frame，若没有则返回-1
-int Machine::findFreeFrame(int virAddr, TranslationEntry *ref) {
-    cout << "trying to find a free frame..." << endl;
+//----------------------------------------------------------------------
+// Machine::OldestFrames
+// 	Put the first "max" frames of the LRU list -- the ones the LRU
+//	policy would evict first, or under the others the ones brought in
+//	longest ago -- in "frames", and return how many there were.
+//----------------------------------------------------------------------
+
+int
+Machine::OldestFrames(int *frames, int max) {
+    int n = 0;
+
+    for (int i = lruFrames->First(); i != -1 && n < max; i = lruFrames->Next(i))
+        frames[n++] = i;
+    return n;
+}
+
+//----------------------------------------------------------------------
+// Machine::NewestFrames
+// 	Put up to "max" of the frames held by page table "owner" in
+//	"frames", the most recently used (or, under policies other than
+//	LRU, the most recently brought in) first, and return how many
+//	there were.  Frames shared with other page tables are left out.
+//----------------------------------------------------------------------
+
+int
+Machine::NewestFrames(PageTable *owner, int *frames, int max) {
+    int n = 0;
+
+    for (int i = lruFrames->Last(); i != -1 && n < max; i = lruFrames->Prev(i)) {
+        if (GlobalPageTable[i].RefPageTable == owner && GlobalPageTable[i].refCount == 1)
+            frames[n++] = i;
+    }
+    return n;
+}
+
+//----------------------------------------------------------------------
+// Machine::AddUser
+// 	Record that page table "table" maps "frame" too, at the same
+//	virtual page as its other users.
+//----------------------------------------------------------------------
+
+void
+Machine::AddUser(int frame, PageTable *table) {
+    GlobalEntry *global = &GlobalPageTable[frame];
+    FrameUser *user = new FrameUser;
+
+    ASSERT(global->RefPageTable != NULL);
+    user->pageTable = table;
+    user->virtualPage = global->VirNum;
+    user->next = global->sharers;
+    global->sharers = user;
+    global->refCount++;
+    table->resident++;
+}
+
+//----------------------------------------------------------------------
+// Machine::RemoveUser
+// 	Record that page table "table" no longer maps shared "frame".  If
+//	it was RefPageTable, another user takes its place.
+//----------------------------------------------------------------------
+
+void
+Machine::RemoveUser(int frame, PageTable *table) {
+    GlobalEntry *global = &GlobalPageTable[frame];
+    FrameUser **prev;
+    FrameUser *user;
+
+    ASSERT(global->refCount > 1 && global->sharers != NULL);
+    if (global->RefPageTable == table) {
+        prev = &global->sharers;        // promote the first sharer
+        global->RefPageTable = (*prev)->pageTable;
+        global->VirNum = (*prev)->virtualPage;
+    } else {
+        for (prev = &global->sharers; (*prev)->pageTable != table;
+             prev = &(*prev)->next)
+            ASSERT((*prev)->next != NULL);
+    }
+    user = *prev;
+    *prev = user->next;
+    delete user;
+    global->refCount--;
+    table->resident--;
+}
+
+//----------------------------------------------------------------------
+// Machine::UnmapSharers
+// 	Invalidate shared "frame" in the page table of every user but
+//	RefPageTable, and forget them, leaving the frame with one user.
+//	Their TLB entries and cached translations must be dropped by
+//	the caller.
+//----------------------------------------------------------------------
+
+void
+Machine::UnmapSharers(int frame) {
+    GlobalEntry *global = &GlobalPageTable[frame];
+
+    while (global->sharers != NULL) {
+        FrameUser *user = global->sharers;
+        TranslationEntry *entry = user->pageTable->Lookup(user->virtualPage);
+
+        entry->valid = FALSE;
+        entry->physicalPage = -1;
+        user->pageTable->resident--;
+        global->sharers = user->next;
+        delete user;
+    }
+    global->refCount = 1;
+}
+
+//----------------------------------------------------------------------
+// Machine::OwnerEntry
+// 	Return the page table entry of the page held in "frame".
+//----------------------------------------------------------------------
+
+TranslationEntry *
+Machine::OwnerEntry(int frame) {
+    GlobalEntry *global = &GlobalPageTable[frame];
+
+    ASSERT(global->RefPageTable != NULL);
+    return global->RefPageTable->Lookup(global->VirNum);
+}
+
+//----------------------------------------------------------------------
+// Machine::TestAndClearUse
+// 	Return whether the page in "frame" has been used since the last
+//	call, and clear its use bit.  The hardware may have set the bit in
+//	a TLB entry rather than in the page table, so those are folded in
+//	(and cleared) too; cached translations to the frame are dropped,
+//	since accesses through them would not set the bit again.  A shared
+//	page counts as used if any of its users used it.
+//----------------------------------------------------------------------
+
+bool
+Machine::TestAndClearUse(int frame) {
+    TranslationEntry *entry = OwnerEntry(frame);
+    bool used = entry->use;
+
+    kernel->stats->numFramesScanned++;
+    for (FrameUser *user = GlobalPageTable[frame].sharers; user != NULL;
+         user = user->next) {
+        TranslationEntry *shared = user->pageTable->Lookup(user->virtualPage);
+
+        used = used || shared->use;
+        shared->use = FALSE;
+    }
+    if (tlb != NULL) {
+        for (int i = 0; i < TLBSize; i++) {
+            if (tlb[i].valid && tlb[i].physicalPage == frame) {
+                used = used || tlb[i].use;
+                entry->dirty = entry->dirty || tlb[i].dirty;
+                tlb[i].use = FALSE;
+            }
+        }
+    }
+    entry->use = FALSE;
+    if (used)
+        InvalidateFastTLB(frame);
+    return used;
+}
+
+//----------------------------------------------------------------------
+// Machine::ClockVictim
+// 	Second chance: sweep the hand over the frames, clearing use bits,
+//	until it finds a frame not used since the last sweep.  Takes at
+//	most two sweeps.  Frames free or busy with a transfer are passed
+//	over: they can't be evicted.
+//----------------------------------------------------------------------
+
+int
+Machine::ClockVictim() {
+    for (int i = 0; i < 2 * NumPhysPages + 1; i++) {
+        int frame = clockHand;
+
+        clockHand = (clockHand + 1) % NumPhysPages;
+        if (Candidate(frame) && !TestAndClearUse(frame))
+            return frame;
+    }
+    return -1;              // every frame is free or busy
+}
+
+//----------------------------------------------------------------------
+// Machine::TwoHandClockVictim
+// 	The front hand, HandSpread frames ahead, clears use bits; the back
+//	hand (clockHand) evicts the first frame not used again since the
+//	front hand passed it.  A small spread only keeps pages used very
+//	recently; with a spread of 0 this is FIFO.  Like the back hand,
+//	the front hand skips frames that are free or busy with a
+//	transfer: they have no page whose use bit it could clear.
+//----------------------------------------------------------------------
+
+int
+Machine::TwoHandClockVictim() {
+    int spread = min(HandSpread, NumPhysPages - 1);
+
+    for (int i = 0; i < 2 * NumPhysPages + 1; i++) {
+        int frame = clockHand;
+        int front = (clockHand + spread) % NumPhysPages;
+
+        if (Evictable(front))
+            TestAndClearUse(front);
+        clockHand = (clockHand + 1) % NumPhysPages;
+        if (Candidate(frame) && !TestAndClearUse(frame))
+            return frame;
+    }
+    return -1;              // every frame is free or busy
+}
+
+//----------------------------------------------------------------------
+// Machine::WSClockVictim
+// 	Sweep the hand once over the frames.  A frame used since the last
+//	sweep is in the working set: note the time and move on.  The first
+//	clean page unused for longer than WorkingSetWindow is evicted;
+//	failing that, the first such dirty page (it is written back when
+//	evicted); failing that, the least recently used page seen.  If
+//	every page was in use, fall back to the clock.  Frames free or
+//	busy with a transfer are passed over.
+//----------------------------------------------------------------------
+
+int
+Machine::WSClockVictim() {
+    int now = kernel->stats->totalTicks;
+    int oldDirty = -1;
+    int oldest = -1;
+
     for (int i = 0; i < NumPhysPages; i++) {
-        // 如果某物理页引用指向了了某一个地址空间，则代表该页上有数据，非空闲
-        if (GlobalPageTable[i].RefPageTable == NULL) {
-            cout << "finding memory frame " << i << " !" << endl;
-            // 找到可用的空闲frame后，更新全局的页表
-            GlobalPageTable[i].VirNum = virAddr;
-            GlobalPageTable[i].RefPageTable = ref;
-            GlobalPageTable[i].useStamp = 0;
-            return i;
+        int frame = clockHand;
+        GlobalEntry *global = &GlobalPageTable[frame];
+
+        clockHand = (clockHand + 1) % NumPhysPages;
+        if (!Candidate(frame))
+            continue;
+        if (TestAndClearUse(frame)) {
+            global->lastUse = now;
+            continue;
+        }
+        if (now - global->lastUse > WorkingSetWindow) {
+            if (!OwnerEntry(frame)->dirty)
+                return frame;
+            if (oldDirty == -1)
+                oldDirty = frame;
         }
+        if (oldest == -1 || global->lastUse < GlobalPageTable[oldest].lastUse)
+            oldest = frame;
     }
-    cout << "no free frame found and return -1" << endl;
-    return -1;
+    if (oldDirty != -1)
+        return oldDirty;
+    if (oldest != -1)
+        return oldest;
+    return ClockVictim();
 }
 
 void Machine::printGlbPt() {
@@ -264,3 +700,231 @@ void Machine::printGlbPt() {
 
 
 
+
+//----------------------------------------------------------------------
+// FrameList::FrameList
+// 	Make an empty list that can hold frames 0..numFrames-1.
+//----------------------------------------------------------------------
+
+FrameList::FrameList(int numFrames) {
+    prev = new int[numFrames];
+    next = new int[numFrames];
+    onList = new bool[numFrames];
+    for (int i = 0; i < numFrames; i++)
+        onList[i] = FALSE;
+    head = tail = -1;
+    count = 0;
+}
+
+FrameList::~FrameList() {
+    delete[] prev;
+    delete[] next;
+    delete[] onList;
+}
+
+//----------------------------------------------------------------------
+// FrameList::Append, FrameList::Remove
+// 	Put "frame" at the tail of the list, or take it off the list.
+//----------------------------------------------------------------------
+
+void
+FrameList::Append(int frame) {
+    ASSERT(!onList[frame]);
+    prev[frame] = tail;
+    next[frame] = -1;
+    if (tail == -1)
+        head = frame;
+    else
+        next[tail] = frame;
+    tail = frame;
+    onList[frame] = TRUE;
+    count++;
+}
+
+void
+FrameList::Remove(int frame) {
+    ASSERT(onList[frame]);
+    if (prev[frame] == -1)
+        head = next[frame];
+    else
+        next[prev[frame]] = next[frame];
+    if (next[frame] == -1)
+        tail = prev[frame];
+    else
+        prev[next[frame]] = prev[frame];
+    onList[frame] = FALSE;
+    count--;
+}
+
+//----------------------------------------------------------------------
+// WritePageTable, ReadPageTable
+// 	Write a page table to an open checkpoint file, or read one back
+//	into a new table.  The file the pages come from is the same for
+//	every entry, so it is written once, ahead of the entries.
+//----------------------------------------------------------------------
+
+static void
+WritePageTable(int fd, PageTable *table)
+{
+    int size = table->Size();
+    int length = strlen(table->diskFile) + 1;
+
+    WriteFile(fd, (char *) &size, sizeof(int));
+    WriteFile(fd, (char *) &length, sizeof(int));
+    WriteFile(fd, table->diskFile, length);
+    table->Checkpoint(fd);
+}
+
+static PageTable *
+ReadPageTable(int fd)
+{
+    PageTable *table;
+    int size, length;
+
+    Read(fd, (char *) &size, sizeof(int));
+    table = new PageTable(size);
+    Read(fd, (char *) &length, sizeof(int));
+    table->diskFile = new char[length];
+    Read(fd, table->diskFile, length);
+    table->Restore(fd);
+    return table;
+}
+
+//----------------------------------------------------------------------
+// Machine::Checkpoint
+// 	Write the state of the simulated machine to the open checkpoint
+//	file "fd": the registers, main memory, the page tables of all
+//	address spaces that have pages in memory (the current one first),
+//	and the global page table, with each frame's users written as
+//	indexes into those page tables, followed by the frames in use in
+//	LRU order.
+//
+//	The TLB and the simulator's caches are not saved; they start
+//	empty after a restore, as after a context switch.
+//----------------------------------------------------------------------
+
+void
+Machine::Checkpoint(int fd) {
+    PageTable **owners;
+    int maxOwners = 1;
+    int numOwners = 0;
+    int i, j;
+
+    ASSERT(pageTable != NULL);
+    SyncUseStamps();
+    WriteFile(fd, (char *) registers, sizeof(registers));
+    WriteFile(fd, (char *) perfCounters, sizeof(perfCounters));
+    WriteFile(fd, mainMemory, MemorySize);
+
+    for (i = 0; i < NumPhysPages; i++)
+        maxOwners += GlobalPageTable[i].refCount;
+    owners = new PageTable *[maxOwners];
+    owners[numOwners++] = pageTable;
+    for (i = 0; i < NumPhysPages; i++) {
+        PageTable *ref = GlobalPageTable[i].RefPageTable;
+        FrameUser *user = GlobalPageTable[i].sharers;
+
+        for (;;) {
+            for (j = 0; j < numOwners && owners[j] != ref; j++);
+            if (ref != NULL && j == numOwners)
+                owners[numOwners++] = ref;
+            if (user == NULL)
+                break;
+            ref = user->pageTable;
+            user = user->next;
+        }
+    }
+    WriteFile(fd, (char *) &numOwners, sizeof(int));
+    for (j = 0; j < numOwners; j++)
+        WritePageTable(fd, owners[j]);
+
+    for (i = 0; i < NumPhysPages; i++) {
+        int frame[6];
+
+        for (j = 0; j < numOwners && owners[j] != GlobalPageTable[i].RefPageTable; j++);
+        frame[0] = GlobalPageTable[i].VirNum;
+        frame[1] = GlobalPageTable[i].useStamp;
+        frame[2] = (j < numOwners) ? j : -1;
+        frame[3] = GlobalPageTable[i].lastUse;
+        frame[4] = GlobalPageTable[i].refCount;
+        frame[5] = GlobalPageTable[i].sharedText;
+        WriteFile(fd, (char *) frame, sizeof(frame));
+        for (FrameUser *user = GlobalPageTable[i].sharers; user != NULL;
+             user = user->next) {
+            for (j = 0; owners[j] != user->pageTable; j++);
+            WriteFile(fd, (char *) &j, sizeof(int));
+        }
+    }
+    for (i = lruFrames->First(); i != -1; i = lruFrames->Next(i))
+        WriteFile(fd, (char *) &i, sizeof(int));
+    delete[] owners;
+}
+
+//----------------------------------------------------------------------
+// Machine::Restore
+// 	Read back the state written by Checkpoint.  Page tables of
+//	address spaces other than the current one are recreated only so
+//	that their frames stay allocated (and their dirty pages are
+//	written back when evicted).
+//----------------------------------------------------------------------
+
+void
+Machine::Restore(int fd) {
+    PageTable **owners;
+    int numOwners;
+    int i;
+
+    FlushFastTLB();
+    for (i = 0; i < NumPhysPages; i++)
+        InvalidateDecodedPage(i);
+    Read(fd, (char *) registers, sizeof(registers));
+    Read(fd, (char *) perfCounters, sizeof(perfCounters));
+    Read(fd, mainMemory, MemorySize);
+
+    Read(fd, (char *) &numOwners, sizeof(int));
+    owners = new PageTable *[numOwners];
+    for (i = 0; i < numOwners; i++)
+        owners[i] = ReadPageTable(fd);
+
+    for (i = 0; i < NumPhysPages; i++) {
+        int frame[6];
+
+        Read(fd, (char *) frame, sizeof(frame));
+        GlobalPageTable[i].VirNum = frame[0];
+        GlobalPageTable[i].useStamp = frame[1];
+        GlobalPageTable[i].RefPageTable = (frame[2] >= 0) ? owners[frame[2]] : NULL;
+        GlobalPageTable[i].lastUse = frame[3];
+        GlobalPageTable[i].refCount = frame[4];
+        GlobalPageTable[i].sharedText = frame[5];
+        GlobalPageTable[i].sharers = NULL;
+        if (GlobalPageTable[i].RefPageTable != NULL)
+            GlobalPageTable[i].RefPageTable->resident++;
+        for (int j = 1; j < frame[4]; j++) {
+            FrameUser *user = new FrameUser;
+            int owner;
+
+            Read(fd, (char *) &owner, sizeof(int));
+            user->pageTable = owners[owner];
+            user->virtualPage = frame[0];
+            user->pageTable->resident++;
+            user->next = GlobalPageTable[i].sharers;
+            GlobalPageTable[i].sharers = user;
+        }
+    }
+    delete freeFrames;
+    delete lruFrames;
+    freeFrames = new FrameList(NumPhysPages);
+    lruFrames = new FrameList(NumPhysPages);
+    for (i = 0; i < NumPhysPages; i++) {
+        if (GlobalPageTable[i].RefPageTable == NULL) {
+            freeFrames->Append(i);
+        } else {
+            int frame;
+
+            Read(fd, (char *) &frame, sizeof(int));
+            lruFrames->Append(frame);
+        }
+    }
+    pageTable = owners[0];
+    delete[] owners;
+}
@@ -26,20 +26,32 @@
 #include "translate.h"
 //#include "noff.h"
 
-// Definitions related to the size, and format of user memory
+// Definitions related to the size, and format of user memory.
+//
+// These are part of the machine profile: they keep the values given
+// in machine.cc unless changed by the kernel at startup (see
+// Kernel::SetParameter), before the Machine is created.
 
-const int PageSize = 128;        // set the page size equal to
-// the disk sector size, for simplicity
+extern int PageSize;            // bytes per page; by default the disk
+// sector size, for simplicity
 
-//
-// You are allowed to change this value.
-// Doing so will change the number of pages of physical memory
-// available on the simulated machine.
-//
-const int NumPhysPages = 128;
+extern int NumPhysPages;        // pages of physical memory available on
+// the simulated machine
+
+#define MemorySize (NumPhysPages * PageSize)
 
-const int MemorySize = (NumPhysPages * PageSize);
-const int TLBSize = 4;            // if there is a TLB, make it small
+extern int TLBSize;             // if there is a TLB, make it small
+extern int TLBWays;             // entries in each set of the TLB; a
+// virtual page can only be in set
+// vpn % (TLBSize / TLBWays)
+
+const int NumASIDs = 64;        // address space IDs the TLB can tell
+// apart
+
+extern int HandSpread;          // frames the front hand of the two-handed
+// clock runs ahead of the back hand
+extern int WorkingSetWindow;    // ticks after which WSClock considers an
+// unused page out of the working set
 
 enum ExceptionType {
     NoException,           // Everything ok!
@@ -54,6 +66,8 @@ enum ExceptionType {
     // address space
     OverflowException,     // Integer overflow in add or sub.
     IllegalInstrException, // Unimplemented or reserved instr.
+    TLBMissException,      // No TLB entry for the page (the
+    // kernel must refill the TLB)
 
     NumExceptionTypes
 };
@@ -91,23 +105,179 @@ enum ExceptionType {
 // translate.cc.
 
 
+// One of the users of a frame other than the one the global page table
+// names (RefPageTable at VirNum), on the frame's reverse map.  Pages are
+// shared at the same virtual page number in every address space, so
+// virtualPage is always the frame's VirNum.
+
+class FrameUser {
+public:
+    PageTable *pageTable;     // the user's page table
+    int virtualPage;          // where it maps the frame
+    FrameUser *next;
+};
+
+// A list of physical pages with constant time insertion at the tail,
+// and removal of any frame: the links are arrays indexed by frame
+// number.  The machine keeps the free frames on one, and the frames in
+// use on another, least recently used first.
+
+class FrameList {
+public:
+    FrameList(int numFrames);   // an empty list
+    ~FrameList();
+
+    void Append(int frame);     // put "frame" at the tail
+    void Remove(int frame);     // take "frame" off the list
+    bool IsMember(int frame) { return onList[frame]; }
+    int First() { return head; }        // -1 if the list is empty
+    int Next(int frame) { return next[frame]; } // -1 after the last
+    int Last() { return tail; }
+    int Prev(int frame) { return prev[frame]; } // -1 before the first
+    int NumInList() { return count; }
+
+private:
+    int *prev, *next;           // neighbours of each frame on the list
+    bool *onList;
+    int head, tail;
+    int count;
+};
+
 // 全局页表数据项
 class GlobalEntry {
 public:
     int VirNum = -1;
     long int useStamp = 0;
-    TranslationEntry *RefPageTable = NULL;
+    int lastUse = 0;            // WSClock: when the page was last seen used
+    int refCount = 0;           // page tables mapping the page: more than
+                                // one if it is shared
+    FrameUser *sharers = NULL;  // the refCount - 1 page tables other than
+                                // RefPageTable that map it, at VirNum
+    bool sharedText = FALSE;    // a code page shared by the instances of
+                                // a program: evictable even if shared
+    bool busy = FALSE;          // being filled, or written to swap, by a
+                                // thread waiting for the transfer: not
+                                // to be evicted meanwhile
+    PageTable *RefPageTable = NULL;
 
     void print();
 };
 
-class Instruction;
+// The simulated performance counters.  The numbers are the ones user
+// programs pass to the PerfCounter system call (PERF_ in syscall.h).
+
+enum PerfCounterType {
+    PerfInstructions = 0,   // instructions retired
+    PerfLoads = 1,          // loads issued by user instructions
+    PerfStores = 2,         // stores issued by user instructions
+    PerfTLBMisses = 3,      // TLB misses
+    PerfPageFaults = 4,     // page faults
+    PerfSyscalls = 5,       // system calls
+    PerfUserTicks = 6,      // the user and system time in Statistics
+    PerfSystemTicks = 7,
+    NumPerfCounters = 8
+};
+
+// The following class defines an instruction, represented in both
+// 	undecoded binary form
+//      decoded to identify
+//	    operation to do
+//	    registers to act on
+//	    any immediate operand value
+
+class Instruction {
+public:
+    void Decode();    // decode the binary representation of the instruction
+
+    unsigned int value; // binary representation of the instruction
+
+    char opCode;     // Type of instruction.  This is NOT the same as the
+    // opcode field from the instruction: see defs in mips.h
+    // (0 is never produced by Decode(), so the decoded
+    // instruction cache uses it to mark empty slots)
+    char rs, rt, rd; // Three registers from instruction.
+    int extra;       // Immediate or target or shamt field or offset.
+    // Immediates are sign-extended.
+    void *handler;   // Where the threaded engine executes this
+    // opcode (see Machine::RunThreaded)
+};
 
 class Interrupt;
 
+// Engines that can execute user instructions.  The switch engine is
+// the original one-instruction-at-a-time interpreter, and is kept
+// around to validate the others against.
+
+enum ExecEngine {
+    SwitchEngine,      // OneInstruction's switch on the opcode
+    ThreadedEngine,    // computed-goto dispatch on pre-decoded handlers
+    BlockEngine        // threaded dispatch over translated basic blocks
+};
+
+// Policies for choosing the frame to evict when a page fault finds no
+// free frame.  LRU needs a time stamp bumped on every access; the
+// others only look at the use and dirty bits the hardware keeps in the
+// page tables (and TLB).
+
+enum ReplacementPolicy {
+    LRUReplacement,           // the head of the LRU list, which every
+                              // access moves a frame to the tail of
+    ClockReplacement,         // second chance: a hand clears use bits and
+                              // evicts the first frame found unused
+    TwoHandClockReplacement,  // a front hand clears use bits, a back hand
+                              // HandSpread frames behind evicts
+    WSClockReplacement        // clock preferring clean pages unused for
+                              // longer than WorkingSetWindow
+};
+
+// A basic block of user code, translated for the block engine: the
+// decoded instructions from "startPC" up to and including the delay
+// slot of the branch or jump that ends the block.  Blocks never cross
+// a page, so a block lives and dies with the frame holding its code.
+
+class CodeBlock {
+public:
+    PageTable *space;         // page table the block was translated under
+    int startPC;              // virtual address of the first instruction
+    int frame;                // physical page holding the code
+    int generation;           // frameGeneration[frame] at translation time
+    int length;               // number of instructions
+    Instruction *code;        // the decoded instructions
+    CodeBlock *next;          // next block in the same hash bucket
+};
+
+const int BlockTableSize = 1024;    // buckets in the translated block table
+
+// An entry in the simulator's own cache of recent linear page table
+// translations, used to short-circuit Translate in ReadMem, WriteMem
+// and instruction fetch.  This is not part of the simulated hardware:
+// user programs and the kernel cannot see it, and it is only ever
+// filled from a successful Translate.
+//
+// The use bit of a page is set when its entry is filled.  Write
+// permission is only granted once the page is dirty, so the hardware
+// use and dirty bits stay exact; accesses through the cache are
+// counted in "hits" and added to the frame's useStamp in batches.
+
+class FastTranslation {
+public:
+    PageTable *space;         // page table the mapping came from
+    unsigned int vpn;         // virtual page (NoFastVpn if unused)
+    int frame;                // physical page it maps to
+    char *host;               // start of that frame in mainMemory
+    bool canRead;             // reads may bypass Translate
+    bool canWrite;            // writes may bypass Translate
+    int hits;                 // uses not yet added to the useStamp
+};
+
+const int FastTLBSize = 64;         // entries in the translation cache
+const unsigned int NoFastVpn = 0xffffffff;  // vpn of an unused entry
+
 class Machine {
 public:
-    Machine(bool debug);    // Initialize the simulation of the hardware
+    Machine(bool debug, ExecEngine whichEngine,
+            ReplacementPolicy whichPolicy);
+    // Initialize the simulation of the hardware
     // for running user programs
     ~Machine();            // De-allocate the data structures
 
@@ -147,14 +317,33 @@ public:
 // the contents of the TLB are free to be modified by the kernel software.
 
     // 寻找空闲的物理页
-    int findFreeFrame(int, TranslationEntry *);
+    int findFreeFrame(int, PageTable *);
+
+    void UseFrame(int frame, int vpn, PageTable *ref);
+    // Record that "frame" now holds page "vpn"
+    // of "ref" alone, just brought in
+    void FreeFrame(int frame);
+    // Put a frame its only user is done with
+    // back on the free list
+    void TouchFrame(int frame, int uses) {
+        GlobalPageTable[frame].useStamp += uses;
+        if (uses > 0 && replacement == LRUReplacement
+            && lruFrames->IsMember(frame)) {
+            lruFrames->Remove(frame);
+            lruFrames->Append(frame);
+        }
+    }
+    // "frame" has been accessed "uses" times
 
     // 全局页表
     GlobalEntry *GlobalPageTable;
 
     TranslationEntry *tlb;        // this pointer should be considered
     // "read-only" to Nachos kernel code
-    TranslationEntry *pageTable;
+    int asid;                     // TLB entries are only used if they
+    // carry this address space ID
+    PageTable *pageTable;         // if there is a TLB, the hardware
+    // ignores this: it is the kernel's
     unsigned int pageTableSize;
 
     bool ReadMem(int addr, int size, int *value);
@@ -164,14 +353,64 @@ public:
     // memory (at addr).  Return FALSE if a
     // correct translation couldn't be found.
 
-    // 利用LRU算法寻找当前最少使用的物理页
+    // 利用LRU算法寻找最久未使用的物理页
     int findFreeByLRU();
 
+    int FindVictim(PageTable *owner = NULL);
+    // The frame to evict when none is free,
+    // chosen by the replacement policy among
+    // those of "owner" (if not NULL); -1 if
+    // no frame can be evicted now
+    int NumFreeFrames() { return freeFrames->NumInList(); }
+    int OldestFrames(int *frames, int max);
+    // The first "max" frames of the LRU list
+    int NewestFrames(PageTable *owner, int *frames, int max);
+    // The last "max" frames of the LRU list
+    // that "owner" holds, newest first
+
+    void AddUser(int frame, PageTable *table);
+    // "table" now maps shared "frame" too
+    void RemoveUser(int frame, PageTable *table);
+    // "table" no longer maps shared "frame"
+    void UnmapSharers(int frame);
+    // Take shared "frame" out of every page
+    // table but RefPageTable's, e.g. to evict it
+    bool Evictable(int frame) {
+        return !GlobalPageTable[frame].busy
+               && GlobalPageTable[frame].RefPageTable != NULL;
+    }
+
     // 打印全局页表，debug方法
     void printGlbPt();
 
-    // 程序元信息
-    int *FileAddr;
+    void InvalidateDecodedPage(int frame);
+    // Forget the cached decodings of the
+    // instructions in physical page "frame".
+    // Must be called whenever the kernel
+    // overwrites the contents of a frame.
+
+    void InvalidateFastTLB(int frame);
+    // Forget any cached translation to
+    // "frame".  Must be called whenever a
+    // page table entry mapping it changes.
+
+    void FlushFastTLB();    // Forget all cached translations
+
+    void SyncUseStamps();   // Add the accesses counted in the
+    // translation cache to the useStamps
+
+    int ReadCounter(PerfCounterType which);
+    // Value of a performance counter, counted
+    // since the machine was started
+
+    void Checkpoint(int fd);
+    // Write the registers, memory, and every
+    // page table with pages in memory to a
+    // checkpoint; the current one comes first
+
+    void Restore(int fd);
+    // Read them back, setting pageTable to the
+    // current page table of the checkpoint
 
 private:
 
@@ -182,7 +421,36 @@ private:
     void OneInstruction(Instruction *instr);
     // Run one instruction of a user program.
 
+    bool FetchInstruction(Instruction *instr);
+    // Fetch the instruction at the PC, using
+    // the decoded instruction cache.  Return
+    // FALSE if an exception occurred.
+
+    Instruction *FetchDecoded();
+    // Same, but return the cache slot itself
+    // (NULL if an exception occurred)
+
+    Instruction *DecodedAt(int physAddr);
+    // Cache slot for the word at physAddr,
+    // decoding it if necessary
 
+    CodeBlock *FindBlock();
+    // Translated block starting at the PC,
+    // translating it if needed (NULL if the
+    // fetch caused an exception)
+
+    void RunThreaded();
+    // Run user code with the threaded engine
+
+
+
+    char *FastLookup(int virtAddr, int size, bool writing);
+    // Host address of virtAddr according to
+    // the translation cache, or NULL if it
+    // has no usable entry
+
+    void RecordTranslation(int virtAddr, int physAddr);
+    // Cache a translation Translate just made
 
     ExceptionType Translate(int virtAddr, int *physAddr, int size, bool writing);
     // Translate an address, and check for
@@ -203,8 +471,56 @@ private:
 
     int registers[NumTotalRegs]; // CPU registers, for executing user programs
 
+    Instruction **decodedPages;    // decoded instruction cache, indexed by
+    // physical page.  Each page gets an array of
+    // PageSize/4 instructions the first time code
+    // is fetched from it; NULL if never fetched.
+    void **dispatchTable;    // handler for each opcode, used by the
+    // threaded engine; NULL until it has started
+
+    ReplacementPolicy replacement;  // how FindVictim chooses
+    PageTable *victimOwner;   // whose frames it may choose, if not
+    // everyone's
+    bool Candidate(int frame) {
+        return Evictable(frame) && (victimOwner == NULL
+               || GlobalPageTable[frame].RefPageTable == victimOwner);
+    }
+    int clockHand;            // next frame the clock hand looks at
+    FrameList *freeFrames;    // frames no page table maps
+    FrameList *lruFrames;     // the others, least recently used first
+                              // (under LRU; otherwise least recently
+                              // brought in)
+
+    TranslationEntry *OwnerEntry(int frame);
+    // The page table entry mapping "frame"
+    bool TestAndClearUse(int frame);
+    // Was the page in "frame" used since
+    // we last looked?
+    int ClockVictim();        // the replacement policies
+    int TwoHandClockVictim();
+    int WSClockVictim();
+
+    ExecEngine engine;        // which engine Run() uses
+
+    int *frameGeneration;     // bumped whenever code in a frame changes;
+    // translated blocks from older generations
+    // are stale
+    CodeBlock **blockTable;   // translated blocks, hashed on (page
+    // table, start PC)
+    FastTranslation *fastTLB; // cache of recent translations, indexed
+    // by vpn % FastTLBSize
+
+    int perfCounters[NumPerfCounters];
+    // the event counters (the tick counters
+    // are kept in Statistics)
+
+    int numTraps;             // # of times RaiseException was called;
+    // lets the engines notice the kernel ran
+
     bool singleStep;        // drop back into the debugger after each
     // simulated instruction
+    bool traceInstructions;    // print each instruction as it is run
+    // (debug flag 'm')
     int runUntilTime;        // drop back into the debugger when simulated
     // time reaches this value
 
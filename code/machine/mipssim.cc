@@ -24,31 +24,22 @@
 
 static void Mult(int a, int b, bool signedArith, int* hiPtr, int* loPtr);
 
-// The following class defines an instruction, represented in both
-// 	undecoded binary form
-//      decoded to identify
-//	    operation to do
-//	    registers to act on
-//	    any immediate operand value
-
-class Instruction {
-  public:
-    void Decode();	// decode the binary representation of the instruction
-
-    unsigned int value; // binary representation of the instruction
-
-    char opCode;     // Type of instruction.  This is NOT the same as the
-    		     // opcode field from the instruction: see defs in mips.h
-    char rs, rt, rd; // Three registers from instruction.
-    int extra;       // Immediate or target or shamt field or offset.
-                     // Immediates are sign-extended.
-};
-
 //----------------------------------------------------------------------
 // Machine::Run
 // 	Simulate the execution of a user-level program on Nachos.
 //	Called by the kernel when the program starts up; never returns.
 //
+//	Instructions are run in batches that end just before the next
+//	pending interrupt is due (see Interrupt::InstructionsUntilDue).
+//	Inside a batch simulated time is simply advanced by UserTick per
+//	instruction; the full OneTick bookkeeping (checking for due
+//	interrupts, time-slice yields) is only done for the last
+//	instruction of the batch, or for one that trapped into the
+//	kernel, since only those can find anything to do.  Interrupts
+//	therefore fire on exactly the same ticks as when OneTick is
+//	called after every instruction -- which is still what happens
+//	when single stepping, or tracing instructions or interrupts.
+//
 //	This routine is re-entrant, in that it can be called multiple
 //	times concurrently -- one for each thread executing user code.
 //----------------------------------------------------------------------
@@ -57,17 +48,35 @@ void
 Machine::Run()
 {
     Instruction *instr = new Instruction;  // storage for decoded instruction
+    Statistics *stats = kernel->stats;
+    int budget, traps;
 
     if (debug->IsEnabled('m')) {
         cout << "Starting program in thread: " << kernel->currentThread->getName();
 	cout << ", at time: " << kernel->stats->totalTicks << "\n";
     }
     kernel->interrupt->setStatus(UserMode);
+    if (singleStep || traceInstructions || debug->IsEnabled(dbgInt)) {
+	for (;;) {			// one tick at a time
+	    OneInstruction(instr);
+	    kernel->interrupt->OneTick();
+	    if (singleStep && (runUntilTime <= kernel->stats->totalTicks))
+		Debugger();
+	}
+    }
+    if (engine != SwitchEngine)
+	RunThreaded();		// never returns
     for (;;) {
-        OneInstruction(instr);
+	budget = kernel->interrupt->InstructionsUntilDue();
+	traps = numTraps;
+	for (;;) {
+	    OneInstruction(instr);
+	    if (--budget == 0 || numTraps != traps)
+		break;
+	    stats->totalTicks += UserTick;	// nothing can be due yet
+	    stats->userTicks += UserTick;
+	}
 	kernel->interrupt->OneTick();
-	if (singleStep && (runUntilTime <= kernel->stats->totalTicks))
-	  Debugger();
     }
 }
 
@@ -114,7 +123,9 @@ TypeToReg(RegType reg, Instruction *instr)
 //	store all data back to the machine registers and memory before
 //	leaving.  This allows the Nachos kernel to control our behavior
 //	by controlling the contents of memory, the translation table,
-//	and the register set.
+//	and the register set.  (The decoded instruction cache does not
+//	break this: it is indexed by physical address and dropped
+//	whenever the underlying memory is written.)
 //----------------------------------------------------------------------
 
 void
@@ -124,18 +135,15 @@ Machine::OneInstruction(Instruction *instr)
     int byte;       // described in Kane for LWL,LWR,...
 #endif
 
-    int raw;
     int nextLoadReg = 0; 	
     int nextLoadValue = 0; 	// record delayed load operation, to apply
 				// in the future
 
     // Fetch instruction 
-    if (!ReadMem(registers[PCReg], 4, &raw))
+    if (!FetchInstruction(instr))
 	return;			// exception occurred
-    instr->value = raw;
-    instr->Decode();
 
-    if (debug->IsEnabled('m')) {
+    if (traceInstructions) {
         struct OpString *str = &opStrings[instr->opCode];
 	char buf[80];
 
@@ -698,6 +706,855 @@ Machine::OneInstruction(Instruction *instr)
 						// are jumping into lala-land
     registers[PCReg] = registers[NextPCReg];
     registers[NextPCReg] = pcAfter;
+    perfCounters[PerfInstructions]++;
+}
+
+//----------------------------------------------------------------------
+// Machine::RunThreaded
+// 	Execute user instructions with a threaded-code engine.  This is
+//	the same simulation as OneInstruction, but instead of a switch
+//	on the opcode of every instruction, each decoded instruction in
+//	the decoded instruction cache carries the address of the code
+//	that executes it (GCC's "labels as values"), and each handler
+//	jumps straight to the next one.  There is one handler per OP_*
+//	opcode, so none of them re-test the opcode.
+//
+//	Exceptions leave a handler without committing the instruction,
+//	exactly as the "return"s in OneInstruction do.
+//
+//	Time is advanced in batches, as in Run().  Not used when single
+//	stepping or tracing.
+//
+//	With the block engine, instructions come from translated basic
+//	blocks (see FindBlock) instead of being fetched one at a time, so
+//	the fetch address is only translated once per block.  Each
+//	instruction is still counted against the batch, so simulated time
+//	and the statistics are the same as with the other engines.
+//
+//	Never returns, like Run().
+//----------------------------------------------------------------------
+
+void
+Machine::RunThreaded()
+{
+    static void *handlers[MaxOpcode + 1];
+    Instruction *cached;
+    Instruction instr;		// private copy -- the cache slot may be
+				// invalidated while the instruction runs
+    bool useBlocks = (engine == BlockEngine && tlb == NULL);
+				// blocks are keyed on the page table, so
+				// they need one
+    CodeBlock *block = NULL;	// block being run by the block engine
+    int blockIndex = 0;		// next instruction of "block" to run
+    int blockTraps = 0;		// numTraps when we entered "block"
+    Statistics *stats = kernel->stats;
+    int budget;			// instructions left in this batch
+    int batchTraps;		// numTraps when the batch started
+    int nextLoadReg, nextLoadValue, pcAfter;
+    int sum, diff, tmp, value;
+    unsigned int rs, rt, imm;
+#ifdef SIM_FIX
+    int byte;       // described in Kane for LWL,LWR,...
+#endif
+
+    if (dispatchTable == NULL) {
+	for (int i = 0; i <= MaxOpcode; i++)
+	    handlers[i] = &&op_bad;
+	handlers[OP_ADD] = &&op_add;
+	handlers[OP_ADDI] = &&op_addi;
+	handlers[OP_ADDIU] = &&op_addiu;
+	handlers[OP_ADDU] = &&op_addu;
+	handlers[OP_AND] = &&op_and;
+	handlers[OP_ANDI] = &&op_andi;
+	handlers[OP_BEQ] = &&op_beq;
+	handlers[OP_BGEZ] = &&op_bgez;
+	handlers[OP_BGEZAL] = &&op_bgezal;
+	handlers[OP_BGTZ] = &&op_bgtz;
+	handlers[OP_BLEZ] = &&op_blez;
+	handlers[OP_BLTZ] = &&op_bltz;
+	handlers[OP_BLTZAL] = &&op_bltzal;
+	handlers[OP_BNE] = &&op_bne;
+	handlers[OP_DIV] = &&op_div;
+	handlers[OP_DIVU] = &&op_divu;
+	handlers[OP_J] = &&op_j;
+	handlers[OP_JAL] = &&op_jal;
+	handlers[OP_JALR] = &&op_jalr;
+	handlers[OP_JR] = &&op_jr;
+	handlers[OP_LB] = &&op_lb;
+	handlers[OP_LBU] = &&op_lbu;
+	handlers[OP_LH] = &&op_lh;
+	handlers[OP_LHU] = &&op_lhu;
+	handlers[OP_LUI] = &&op_lui;
+	handlers[OP_LW] = &&op_lw;
+	handlers[OP_LWL] = &&op_lwl;
+	handlers[OP_LWR] = &&op_lwr;
+	handlers[OP_MFHI] = &&op_mfhi;
+	handlers[OP_MFLO] = &&op_mflo;
+	handlers[OP_MTHI] = &&op_mthi;
+	handlers[OP_MTLO] = &&op_mtlo;
+	handlers[OP_MULT] = &&op_mult;
+	handlers[OP_MULTU] = &&op_multu;
+	handlers[OP_NOR] = &&op_nor;
+	handlers[OP_OR] = &&op_or;
+	handlers[OP_ORI] = &&op_ori;
+	handlers[OP_RFE] = &&op_illegal;
+	handlers[OP_SB] = &&op_sb;
+	handlers[OP_SH] = &&op_sh;
+	handlers[OP_SLL] = &&op_sll;
+	handlers[OP_SLLV] = &&op_sllv;
+	handlers[OP_SLT] = &&op_slt;
+	handlers[OP_SLTI] = &&op_slti;
+	handlers[OP_SLTIU] = &&op_sltiu;
+	handlers[OP_SLTU] = &&op_sltu;
+	handlers[OP_SRA] = &&op_sra;
+	handlers[OP_SRAV] = &&op_srav;
+	handlers[OP_SRL] = &&op_srl;
+	handlers[OP_SRLV] = &&op_srlv;
+	handlers[OP_SUB] = &&op_sub;
+	handlers[OP_SUBU] = &&op_subu;
+	handlers[OP_SW] = &&op_sw;
+	handlers[OP_SWL] = &&op_swl;
+	handlers[OP_SWR] = &&op_swr;
+	handlers[OP_XOR] = &&op_xor;
+	handlers[OP_XORI] = &&op_xori;
+	handlers[OP_SYSCALL] = &&op_syscall;
+	handlers[OP_UNIMP] = &&op_illegal;
+	handlers[OP_RES] = &&op_illegal;
+
+	// anything decoded so far has no handler yet
+	for (int i = 0; i < NumPhysPages; i++)
+	    InvalidateDecodedPage(i);
+	dispatchTable = handlers;
+    }
+    budget = kernel->interrupt->InstructionsUntilDue();
+    batchTraps = numTraps;
+
+  fetch:
+    if (useBlocks) {
+	// Stay in the current block as long as execution falls through
+	// it and nothing has happened behind our back: no trap into the
+	// kernel (which may have changed the address space) and no change
+	// to the code frame.
+	if (block == NULL || blockIndex >= block->length
+		|| registers[PCReg] != block->startPC + IndexToAddr(blockIndex)
+		|| block->generation != frameGeneration[block->frame]
+		|| blockTraps != numTraps) {
+	    block = FindBlock();
+	    if (block == NULL)
+		goto tick;		// exception occurred
+	    blockIndex = 0;
+	    blockTraps = numTraps;
+	} else {
+	    // account for the fetch as Translate would have
+	    pageTable->Lookup(block->startPC / PageSize)->use = TRUE;
+	    if (replacement == LRUReplacement)
+		TouchFrame(block->frame, 1);
+	}
+	instr = block->code[blockIndex++];
+    } else {
+	cached = FetchDecoded();
+	if (cached == NULL)
+	    goto tick;		// exception occurred
+	instr = *cached;
+    }
+    pcAfter = registers[NextPCReg] + 4;
+    nextLoadReg = 0;
+    nextLoadValue = 0;
+    goto *instr.handler;
+
+  op_add:
+    sum = registers[instr.rs] + registers[instr.rt];
+    if (!((registers[instr.rs] ^ registers[instr.rt]) & SIGN_BIT) &&
+	((registers[instr.rs] ^ sum) & SIGN_BIT)) {
+	RaiseException(OverflowException, 0);
+	goto tick;
+    }
+    registers[instr.rd] = sum;
+    goto commit;
+
+  op_addi:
+    sum = registers[instr.rs] + instr.extra;
+    if (!((registers[instr.rs] ^ instr.extra) & SIGN_BIT) &&
+	((instr.extra ^ sum) & SIGN_BIT)) {
+	RaiseException(OverflowException, 0);
+	goto tick;
+    }
+    registers[instr.rt] = sum;
+    goto commit;
+
+  op_addiu:
+    registers[instr.rt] = registers[instr.rs] + instr.extra;
+    goto commit;
+
+  op_addu:
+    registers[instr.rd] = registers[instr.rs] + registers[instr.rt];
+    goto commit;
+
+  op_and:
+    registers[instr.rd] = registers[instr.rs] & registers[instr.rt];
+    goto commit;
+
+  op_andi:
+    registers[instr.rt] = registers[instr.rs] & (instr.extra & 0xffff);
+    goto commit;
+
+  op_beq:
+    if (registers[instr.rs] == registers[instr.rt])
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr.extra);
+    goto commit;
+
+  op_bgezal:
+    registers[R31] = registers[NextPCReg] + 4;
+  op_bgez:
+    if (!(registers[instr.rs] & SIGN_BIT))
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr.extra);
+    goto commit;
+
+  op_bgtz:
+    if (registers[instr.rs] > 0)
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr.extra);
+    goto commit;
+
+  op_blez:
+    if (registers[instr.rs] <= 0)
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr.extra);
+    goto commit;
+
+  op_bltzal:
+    registers[R31] = registers[NextPCReg] + 4;
+  op_bltz:
+    if (registers[instr.rs] & SIGN_BIT)
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr.extra);
+    goto commit;
+
+  op_bne:
+    if (registers[instr.rs] != registers[instr.rt])
+	pcAfter = registers[NextPCReg] + IndexToAddr(instr.extra);
+    goto commit;
+
+  op_div:
+    if (registers[instr.rt] == 0) {
+	registers[LoReg] = 0;
+	registers[HiReg] = 0;
+    } else {
+	registers[LoReg] = registers[instr.rs] / registers[instr.rt];
+	registers[HiReg] = registers[instr.rs] % registers[instr.rt];
+    }
+    goto commit;
+
+  op_divu:
+    rs = (unsigned int) registers[instr.rs];
+    rt = (unsigned int) registers[instr.rt];
+    if (rt == 0) {
+	registers[LoReg] = 0;
+	registers[HiReg] = 0;
+    } else {
+	tmp = rs / rt;
+	registers[LoReg] = (int) tmp;
+	tmp = rs % rt;
+	registers[HiReg] = (int) tmp;
+    }
+    goto commit;
+
+  op_jal:
+    registers[R31] = registers[NextPCReg] + 4;
+  op_j:
+    pcAfter = (pcAfter & 0xf0000000) | IndexToAddr(instr.extra);
+    goto commit;
+
+  op_jalr:
+    registers[instr.rd] = registers[NextPCReg] + 4;
+  op_jr:
+    pcAfter = registers[instr.rs];
+    goto commit;
+
+  op_lb:
+    tmp = registers[instr.rs] + instr.extra;
+    if (!ReadMem(tmp, 1, &value))
+	goto tick;
+    if (value & 0x80)
+	value |= 0xffffff00;
+    else
+	value &= 0xff;
+    nextLoadReg = instr.rt;
+    nextLoadValue = value;
+    goto commit;
+
+  op_lbu:
+    tmp = registers[instr.rs] + instr.extra;
+    if (!ReadMem(tmp, 1, &value))
+	goto tick;
+    nextLoadReg = instr.rt;
+    nextLoadValue = value & 0xff;
+    goto commit;
+
+  op_lh:
+    tmp = registers[instr.rs] + instr.extra;
+    if (tmp & 0x1) {
+	RaiseException(AddressErrorException, tmp);
+	goto tick;
+    }
+    if (!ReadMem(tmp, 2, &value))
+	goto tick;
+    if (value & 0x8000)
+	value |= 0xffff0000;
+    else
+	value &= 0xffff;
+    nextLoadReg = instr.rt;
+    nextLoadValue = value;
+    goto commit;
+
+  op_lhu:
+    tmp = registers[instr.rs] + instr.extra;
+    if (tmp & 0x1) {
+	RaiseException(AddressErrorException, tmp);
+	goto tick;
+    }
+    if (!ReadMem(tmp, 2, &value))
+	goto tick;
+    nextLoadReg = instr.rt;
+    nextLoadValue = value & 0xffff;
+    goto commit;
+
+  op_lui:
+    registers[instr.rt] = instr.extra << 16;
+    goto commit;
+
+  op_lw:
+    tmp = registers[instr.rs] + instr.extra;
+    if (tmp & 0x3) {
+	RaiseException(AddressErrorException, tmp);
+	goto tick;
+    }
+    if (!ReadMem(tmp, 4, &value))
+	goto tick;
+    nextLoadReg = instr.rt;
+    nextLoadValue = value;
+    goto commit;
+
+  op_lwl:
+    tmp = registers[instr.rs] + instr.extra;
+#ifdef SIM_FIX
+    byte = tmp & 0x3;
+    if (!ReadMem(tmp-byte, 4, &value))
+	goto tick;
+#else
+    ASSERT((tmp & 0x3) == 0);
+    if (!ReadMem(tmp, 4, &value))
+	goto tick;
+#endif
+    if (registers[LoadReg] == instr.rt)
+	nextLoadValue = registers[LoadValueReg];
+    else
+	nextLoadValue = registers[instr.rt];
+#ifdef SIM_FIX
+    switch (3 - byte)
+#else
+    switch (tmp & 0x3)
+#endif
+      {
+      case 0:
+	nextLoadValue = value;
+	break;
+      case 1:
+	nextLoadValue = (nextLoadValue & 0xff) | (value << 8);
+	break;
+      case 2:
+	nextLoadValue = (nextLoadValue & 0xffff) | (value << 16);
+	break;
+      case 3:
+	nextLoadValue = (nextLoadValue & 0xffffff) | (value << 24);
+	break;
+    }
+    nextLoadReg = instr.rt;
+    goto commit;
+
+  op_lwr:
+    tmp = registers[instr.rs] + instr.extra;
+#ifdef SIM_FIX
+    byte = tmp & 0x3;
+    if (!ReadMem(tmp-byte, 4, &value))
+	goto tick;
+#else
+    ASSERT((tmp & 0x3) == 0);
+    if (!ReadMem(tmp, 4, &value))
+	goto tick;
+#endif
+    if (registers[LoadReg] == instr.rt)
+	nextLoadValue = registers[LoadValueReg];
+    else
+	nextLoadValue = registers[instr.rt];
+#ifdef SIM_FIX
+    switch (3 - byte)
+#else
+    switch (tmp & 0x3)
+#endif
+      {
+      case 0:
+	nextLoadValue = (nextLoadValue & 0xffffff00) |
+	    ((value >> 24) & 0xff);
+	break;
+      case 1:
+	nextLoadValue = (nextLoadValue & 0xffff0000) |
+	    ((value >> 16) & 0xffff);
+	break;
+      case 2:
+	nextLoadValue = (nextLoadValue & 0xff000000)
+	    | ((value >> 8) & 0xffffff);
+	break;
+      case 3:
+	nextLoadValue = value;
+	break;
+    }
+    nextLoadReg = instr.rt;
+    goto commit;
+
+  op_mfhi:
+    registers[instr.rd] = registers[HiReg];
+    goto commit;
+
+  op_mflo:
+    registers[instr.rd] = registers[LoReg];
+    goto commit;
+
+  op_mthi:
+    registers[HiReg] = registers[instr.rs];
+    goto commit;
+
+  op_mtlo:
+    registers[LoReg] = registers[instr.rs];
+    goto commit;
+
+  op_mult:
+    Mult(registers[instr.rs], registers[instr.rt], TRUE,
+	 &registers[HiReg], &registers[LoReg]);
+    goto commit;
+
+  op_multu:
+    Mult(registers[instr.rs], registers[instr.rt], FALSE,
+	 &registers[HiReg], &registers[LoReg]);
+    goto commit;
+
+  op_nor:
+    registers[instr.rd] = ~(registers[instr.rs] | registers[instr.rt]);
+    goto commit;
+
+  op_or:
+    registers[instr.rd] = registers[instr.rs] | registers[instr.rt];
+    goto commit;
+
+  op_ori:
+    registers[instr.rt] = registers[instr.rs] | (instr.extra & 0xffff);
+    goto commit;
+
+  op_sb:
+    if (!WriteMem((unsigned)
+	    (registers[instr.rs] + instr.extra), 1, registers[instr.rt]))
+	goto tick;
+    goto commit;
+
+  op_sh:
+    if (!WriteMem((unsigned)
+	    (registers[instr.rs] + instr.extra), 2, registers[instr.rt]))
+	goto tick;
+    goto commit;
+
+  op_sll:
+    registers[instr.rd] = registers[instr.rt] << instr.extra;
+    goto commit;
+
+  op_sllv:
+    registers[instr.rd] = registers[instr.rt] <<
+	(registers[instr.rs] & 0x1f);
+    goto commit;
+
+  op_slt:
+    registers[instr.rd] = (registers[instr.rs] < registers[instr.rt]);
+    goto commit;
+
+  op_slti:
+    registers[instr.rt] = (registers[instr.rs] < instr.extra);
+    goto commit;
+
+  op_sltiu:
+    rs = registers[instr.rs];
+    imm = instr.extra;
+    registers[instr.rt] = (rs < imm);
+    goto commit;
+
+  op_sltu:
+    rs = registers[instr.rs];
+    rt = registers[instr.rt];
+    registers[instr.rd] = (rs < rt);
+    goto commit;
+
+  op_sra:
+    registers[instr.rd] = registers[instr.rt] >> instr.extra;
+    goto commit;
+
+  op_srav:
+    registers[instr.rd] = registers[instr.rt] >>
+	(registers[instr.rs] & 0x1f);
+    goto commit;
+
+  op_srl:
+    tmp = registers[instr.rt];
+    tmp >>= instr.extra;
+    registers[instr.rd] = tmp;
+    goto commit;
+
+  op_srlv:
+    tmp = registers[instr.rt];
+    tmp >>= (registers[instr.rs] & 0x1f);
+    registers[instr.rd] = tmp;
+    goto commit;
+
+  op_sub:
+    diff = registers[instr.rs] - registers[instr.rt];
+    if (((registers[instr.rs] ^ registers[instr.rt]) & SIGN_BIT) &&
+	((registers[instr.rs] ^ diff) & SIGN_BIT)) {
+	RaiseException(OverflowException, 0);
+	goto tick;
+    }
+    registers[instr.rd] = diff;
+    goto commit;
+
+  op_subu:
+    registers[instr.rd] = registers[instr.rs] - registers[instr.rt];
+    goto commit;
+
+  op_sw:
+    if (!WriteMem((unsigned)
+	    (registers[instr.rs] + instr.extra), 4, registers[instr.rt]))
+	goto tick;
+    goto commit;
+
+  op_swl:
+    tmp = registers[instr.rs] + instr.extra;
+#ifdef SIM_FIX
+    byte = tmp & 0x3;
+    if (!ReadMem(tmp-byte, 4, &value))
+	goto tick;
+    switch (3 - byte)
+#else
+    ASSERT((tmp & 0x3) == 0);
+    if (!ReadMem((tmp & ~0x3), 4, &value))
+	goto tick;
+    switch (tmp & 0x3)
+#endif
+      {
+      case 0:
+	value = registers[instr.rt];
+	break;
+      case 1:
+	value = (value & 0xff000000) | ((registers[instr.rt] >> 8) &
+					0xffffff);
+	break;
+      case 2:
+	value = (value & 0xffff0000) | ((registers[instr.rt] >> 16) &
+					0xffff);
+	break;
+      case 3:
+	value = (value & 0xffffff00) | ((registers[instr.rt] >> 24) &
+					0xff);
+	break;
+    }
+#ifdef SIM_FIX
+    if (!WriteMem((tmp - byte), 4, value))
+	goto tick;
+#else
+    if (!WriteMem((tmp & ~0x3), 4, value))
+	goto tick;
+#endif
+    goto commit;
+
+  op_swr:
+    tmp = registers[instr.rs] + instr.extra;
+#ifdef SIM_FIX
+    byte = tmp & 0x3;
+    if (!ReadMem(tmp-byte, 4, &value))
+	goto tick;
+    switch (3 - byte)
+#else
+    ASSERT((tmp & 0x3) == 0);
+    if (!ReadMem((tmp & ~0x3), 4, &value))
+	goto tick;
+    switch (tmp & 0x3)
+#endif
+      {
+      case 0:
+	value = (value & 0xffffff) | (registers[instr.rt] << 24);
+	break;
+      case 1:
+	value = (value & 0xffff) | (registers[instr.rt] << 16);
+	break;
+      case 2:
+	value = (value & 0xff) | (registers[instr.rt] << 8);
+	break;
+      case 3:
+	value = registers[instr.rt];
+	break;
+    }
+#ifdef SIM_FIX
+    if (!WriteMem((tmp - byte), 4, value))
+	goto tick;
+#else
+    if (!WriteMem((tmp & ~0x3), 4, value))
+	goto tick;
+#endif
+    goto commit;
+
+  op_syscall:
+    RaiseException(SyscallException, 0);
+    goto tick;
+
+  op_xor:
+    registers[instr.rd] = registers[instr.rs] ^ registers[instr.rt];
+    goto commit;
+
+  op_xori:
+    registers[instr.rt] = registers[instr.rs] ^ (instr.extra & 0xffff);
+    goto commit;
+
+  op_illegal:
+    RaiseException(IllegalInstrException, 0);
+    goto tick;
+
+  op_bad:
+    ASSERTNOTREACHED();
+
+  commit:
+    // the instruction completed: do any delayed load, and advance
+    // the program counters, as at the end of OneInstruction
+    registers[registers[LoadReg]] = registers[LoadValueReg];
+    registers[LoadReg] = nextLoadReg;
+    registers[LoadValueReg] = nextLoadValue;
+    registers[0] = 0;
+    registers[PrevPCReg] = registers[PCReg];
+    registers[PCReg] = registers[NextPCReg];
+    registers[NextPCReg] = pcAfter;
+    perfCounters[PerfInstructions]++;
+
+  tick:
+    if (--budget > 0 && numTraps == batchTraps) {
+	stats->totalTicks += UserTick;	// nothing can be due yet
+	stats->userTicks += UserTick;
+	goto fetch;
+    }
+    kernel->interrupt->OneTick();
+    budget = kernel->interrupt->InstructionsUntilDue();
+    batchTraps = numTraps;
+    goto fetch;
+}
+
+//----------------------------------------------------------------------
+// Machine::FetchDecoded
+// 	Fetch the instruction at the current PC, returning its slot in
+//	the decoded instruction cache.
+//
+//	The address is translated exactly as ReadMem would (so use bits,
+//	page faults and the translation cache behave the same), but the
+//	decoding is taken from the decoded instruction cache when the
+//	physical word has been decoded before.  Tight loops thus only pay for Decode() once.
+//
+//	Returns NULL if the fetch caused an exception.
+//----------------------------------------------------------------------
+
+Instruction *
+Machine::FetchDecoded()
+{
+    ExceptionType exception;
+    int physAddr;
+    char *host;
+
+    host = FastLookup(registers[PCReg], 4, FALSE);
+    if (host != NULL)
+	return DecodedAt(host - mainMemory);
+
+    exception = Translate(registers[PCReg], &physAddr, 4, FALSE);
+    if (exception != NoException) {
+	RaiseException(exception, registers[PCReg]);
+	// as in ReadMem, a page fault or TLB miss is retried once
+	// the kernel has brought the page in
+	if ((exception != PageFaultException
+		&& exception != TLBMissException) ||
+		Translate(registers[PCReg], &physAddr, 4, FALSE) != NoException)
+	    return NULL;
+    }
+    RecordTranslation(registers[PCReg], physAddr);
+    return DecodedAt(physAddr);
+}
+
+//----------------------------------------------------------------------
+// Machine::DecodedAt
+// 	Return the decoded instruction cache slot for the (physical) word
+//	at "physAddr", decoding the word if this has not been done since
+//	the frame was last written.
+//----------------------------------------------------------------------
+
+Instruction *
+Machine::DecodedAt(int physAddr)
+{
+    Instruction *page, *cached;
+
+    page = decodedPages[physAddr / PageSize];
+    if (page == NULL) {
+	page = new Instruction[PageSize / 4];
+	for (int i = 0; i < PageSize / 4; i++)
+	    page[i].opCode = 0;
+	decodedPages[physAddr / PageSize] = page;
+    }
+    cached = &page[(physAddr % PageSize) / 4];
+    if (cached->opCode == 0) {		// not decoded yet
+	cached->value = WordToHost(*(unsigned int *) &mainMemory[physAddr]);
+	cached->Decode();
+	if (dispatchTable != NULL)
+	    cached->handler = dispatchTable[(int) cached->opCode];
+    }
+    return cached;
+}
+
+//----------------------------------------------------------------------
+// IsBranch
+// 	Return TRUE if "opCode" transfers control, so that the block it
+//	is in ends after its delay slot.
+//----------------------------------------------------------------------
+
+static bool
+IsBranch(int opCode)
+{
+    switch (opCode) {
+      case OP_BEQ: case OP_BNE: case OP_BGEZ: case OP_BGEZAL:
+      case OP_BGTZ: case OP_BLEZ: case OP_BLTZ: case OP_BLTZAL:
+      case OP_J: case OP_JAL: case OP_JALR: case OP_JR:
+	return TRUE;
+      default:
+	return FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// IsTrap
+// 	Return TRUE if "opCode" always traps to the kernel, so that the
+//	block it is in ends with it.
+//----------------------------------------------------------------------
+
+static bool
+IsTrap(int opCode)
+{
+    return (opCode == OP_SYSCALL || opCode == OP_RES || opCode == OP_UNIMP);
+}
+
+//----------------------------------------------------------------------
+// Machine::FindBlock
+// 	Return the translated block starting at the current PC, in the
+//	current address space, translating it if there is none or if
+//	the one we have is stale.
+//
+//	The fetch of the first instruction is translated like any other
+//	fetch (so it can page fault); the rest of the block is then known
+//	to be on the same page.  A block is stale if its code frame has
+//	been refilled or written since, or if the page is now mapped to
+//	another frame.
+//
+//	Returns NULL if the fetch caused an exception.
+//----------------------------------------------------------------------
+
+CodeBlock *
+Machine::FindBlock()
+{
+    ExceptionType exception;
+    int pc = registers[PCReg];
+    int physAddr, frame, bucket, length;
+    CodeBlock *block;
+
+    exception = Translate(pc, &physAddr, 4, FALSE);
+    if (exception != NoException) {
+	RaiseException(exception, pc);
+	if ((exception != PageFaultException
+		&& exception != TLBMissException) ||
+		Translate(pc, &physAddr, 4, FALSE) != NoException)
+	    return NULL;
+    }
+    frame = physAddr / PageSize;
+
+    bucket = (int) ((((unsigned long) pageTable >> 4) ^ ((unsigned) pc >> 2))
+			% BlockTableSize);
+    for (block = blockTable[bucket]; block != NULL; block = block->next) {
+	if (block->space == pageTable && block->startPC == pc)
+	    break;
+    }
+    if (block != NULL && block->frame == frame
+		&& block->generation == frameGeneration[frame])
+	return block;				// still good
+
+    if (block == NULL) {
+	block = new CodeBlock;
+	block->space = pageTable;
+	block->startPC = pc;
+	block->code = NULL;
+	block->next = blockTable[bucket];
+	blockTable[bucket] = block;
+    }
+    delete [] block->code;
+
+    // scan to the end of the block: the delay slot of its branch, or
+    // the end of the page, whichever comes first
+    length = 0;
+    while ((physAddr % PageSize) + IndexToAddr(length) < PageSize) {
+	int opCode = DecodedAt(physAddr + IndexToAddr(length))->opCode;
+
+	length++;
+	if (IsTrap(opCode))
+	    break;
+	if (IsBranch(opCode)) {
+	    if ((physAddr % PageSize) + IndexToAddr(length) < PageSize)
+		length++;			// include the delay slot
+	    break;
+	}
+    }
+    block->frame = frame;
+    block->generation = frameGeneration[frame];
+    block->length = length;
+    block->code = new Instruction[length];
+    for (int i = 0; i < length; i++)
+	block->code[i] = *DecodedAt(physAddr + IndexToAddr(i));
+    DEBUG(dbgMach, "Translated block at " << pc << ", " << length << " instructions");
+    return block;
+}
+
+//----------------------------------------------------------------------
+// Machine::FetchInstruction
+// 	Fetch the instruction at the current PC into "instr".
+//	Returns FALSE if the fetch caused an exception.
+//----------------------------------------------------------------------
+
+bool
+Machine::FetchInstruction(Instruction *instr)
+{
+    Instruction *cached = FetchDecoded();
+
+    if (cached == NULL)
+	return FALSE;
+    *instr = *cached;
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// Machine::InvalidateDecodedPage
+// 	Drop every cached decoding for physical page "frame".  Called
+//	by the kernel whenever it replaces the contents of a frame.
+//----------------------------------------------------------------------
+
+void
+Machine::InvalidateDecodedPage(int frame)
+{
+    ASSERT(frame >= 0 && frame < NumPhysPages);
+    if (decodedPages[frame] != NULL) {
+	delete [] decodedPages[frame];
+	decodedPages[frame] = NULL;
+    }
+    frameGeneration[frame]++;		// and any blocks translated from it
 }
 
 //----------------------------------------------------------------------
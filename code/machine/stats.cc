@@ -10,6 +10,19 @@
 #include "copyright.h"
 #include "debug.h"
 #include "stats.h"
+#include "sysdep.h"
+#include "machine.h"
+
+// The cost model; see stats.h.
+
+int UserTick = 	   1;
+int SystemTick =  10;
+int RotationTime = 500;
+int SeekTime =	 500;
+int SwapTime =	1000;
+int ConsoleTime = 100;
+int NetworkTime = 100;
+int TimerTicks =  100;
 
 //----------------------------------------------------------------------
 // Statistics::Statistics
@@ -22,6 +35,37 @@ Statistics::Statistics()
     numDiskReads = numDiskWrites = 0;
     numConsoleCharsRead = numConsoleCharsWritten = 0;
     numPageFaults = numPacketsSent = numPacketsRecvd = 0;
+    numEvictions = numFramesScanned = 0;
+    numDaemonReclaims = numPrecleaned = 0;
+    numSuspensions = 0;
+    for (int i = 0; i < NumLatencyBuckets; i++) {
+	faultLatency[i] = 0;
+    }
+    numSwapReads = numSwapWrites = 0;
+    numMappedWrites = numStackGrowths = 0;
+    numPoolStores = numPoolRejects = numPoolBytes = numPoolHits = 0;
+    numPrefetched = numPrefetchHits = numPrefetchMisses = 0;
+    numResumePrefetched = 0;
+    numCOWCopies = numTextShares = 0;
+    numTLBHits = numTLBMisses = 0;
+}
+
+//----------------------------------------------------------------------
+// Statistics::RecordFaultLatency
+// 	Count a page fault that took "ticks" to handle in the latency
+//	histogram.
+//----------------------------------------------------------------------
+
+void
+Statistics::RecordFaultLatency(int ticks)
+{
+    int bucket = 0;
+
+    while (ticks > 0 && bucket < NumLatencyBuckets - 1) {
+	ticks >>= 1;
+	bucket++;
+    }
+    faultLatency[bucket]++;
 }
 
 //----------------------------------------------------------------------
@@ -39,7 +83,105 @@ Statistics::Print()
 		cout << ", writes " << numDiskWrites << "\n";
 		cout << "Console I/O: reads " << numConsoleCharsRead;
     cout << ", writes " << numConsoleCharsWritten << "\n";
-    cout << "Paging: faults " << numPageFaults << "\n";
+    cout << "Paging: faults " << numPageFaults;
+    if (numEvictions > 0) {
+	cout << ", evictions " << numEvictions;
+	cout << ", frames scanned " << numFramesScanned;
+    }
+    cout << "\n";
+    if (numDaemonReclaims + numPrecleaned > 0) {
+	cout << "Pageout daemon: evictions " << numDaemonReclaims;
+	cout << ", pages pre-cleaned " << numPrecleaned << "\n";
+    }
+    if (numSuspensions > 0) {
+	cout << "Processes suspended to stop thrashing: " << numSuspensions << "\n";
+    }
+    if (numPageFaults > 0) {
+	const char *separator = " ";
+
+	cout << "Page fault latency (ticks):";
+	for (int i = 0; i < NumLatencyBuckets; i++) {
+	    if (faultLatency[i] == 0) {
+		continue;
+	    }
+	    cout << separator;
+	    if (i == 0) {
+		cout << "0";
+	    } else {
+		cout << (1 << (i - 1)) << "-" << (1 << i) - 1;
+	    }
+	    cout << ": " << faultLatency[i];
+	    separator = ", ";
+	}
+	cout << "\n";
+    }
+    if (numSwapReads + numSwapWrites > 0) {
+	cout << "Swap: reads " << numSwapReads;
+	cout << ", writes " << numSwapWrites << "\n";
+    }
+    if (numMappedWrites > 0) {
+	cout << "Mapped files: pages written back " << numMappedWrites << "\n";
+    }
+    if (numStackGrowths > 0) {
+	cout << "Stack growth: pages " << numStackGrowths << "\n";
+    }
+    if (numPoolStores + numPoolRejects > 0) {
+	cout << "Compressed pool: pages kept " << numPoolStores;
+	cout << ", rejected " << numPoolRejects;
+	if (numPoolBytes > 0) {
+	    cout << ", compression ratio "
+		 << (double) numPoolStores * PageSize / numPoolBytes;
+	}
+	cout << "\n";
+	cout << "Compressed pool: hits " << numPoolHits;
+	cout << ", misses " << numSwapReads;
+	if (numPoolHits + numSwapReads > 0) {
+	    cout << ", hit rate "
+		 << 100.0 * numPoolHits / (numPoolHits + numSwapReads) << "%";
+	}
+	cout << "\n";
+    }
+    if (numCOWCopies > 0) {
+	cout << "Copy-on-write: copies " << numCOWCopies << "\n";
+    }
+    if (numTextShares > 0) {
+	cout << "Shared text: pages mapped " << numTextShares << "\n";
+    }
+    if (numPrefetched > 0) {
+	cout << "Readahead: pages " << numPrefetched;
+	cout << ", hits " << numPrefetchHits;
+	cout << ", misses " << numPrefetchMisses << "\n";
+    }
+    if (numResumePrefetched > 0) {
+	cout << "Working sets prefetched on resume: pages " << numResumePrefetched << "\n";
+    }
+    if (numTLBHits + numTLBMisses > 0) {
+	cout << "TLB: hits " << numTLBHits << ", misses " << numTLBMisses << "\n";
+    }
     cout << "Network I/O: packets received " << numPacketsRecvd;
 		cout << ", sent " << numPacketsSent << "\n";
 }
+
+//----------------------------------------------------------------------
+// Statistics::Checkpoint
+// 	Write all performance metrics to the open checkpoint file "fd".
+//	They are all plain integers, so they are written as they are.
+//----------------------------------------------------------------------
+
+void
+Statistics::Checkpoint(int fd)
+{
+    WriteFile(fd, (char *) this, sizeof(Statistics));
+}
+
+//----------------------------------------------------------------------
+// Statistics::Restore
+// 	Read back the performance metrics written by Checkpoint, so that
+//	a restored run goes on counting from where the saved one was.
+//----------------------------------------------------------------------
+
+void
+Statistics::Restore(int fd)
+{
+    Read(fd, (char *) this, sizeof(Statistics));
+}
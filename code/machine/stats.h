@@ -13,6 +13,13 @@
 
 #include "copyright.h"
 
+// Page faults are counted by how long they took, in buckets of powers
+// of two ticks: bucket 0 holds the faults that took no time, bucket i
+// those that took from 2^(i-1) to 2^i - 1 ticks.  The last bucket also
+// holds everything longer.
+
+const int NumLatencyBuckets = 24;
+
 // The following class defines the statistics that are to be kept
 // about Nachos behavior -- how much time (ticks) elapsed, how
 // many user instructions executed, etc.
@@ -33,12 +40,45 @@ class Statistics {
     int numConsoleCharsRead;	// number of characters read from the keyboard
     int numConsoleCharsWritten; // number of characters written to the display
     int numPageFaults;		// number of virtual memory page faults
+    int numEvictions;		// number of pages evicted to make room
+    int numFramesScanned;	// frames the replacement policy looked at
+    int numDaemonReclaims;	// of the evictions, those made by the
+				// pageout daemon rather than a page fault
+    int numPrecleaned;		// dirty pages it wrote back early
+    int numSuspensions;		// processes swapped out because memory
+				// couldn't hold all their allotments
+    int numSwapReads;		// pages read back from swap
+    int numSwapWrites;		// pages written to swap
+    int numMappedWrites;	// pages of mapped files written back
+    int numStackGrowths;	// pages the stack grew down by
+    int numPoolStores;		// pages kept in the compressed pool
+				// instead of being written to swap
+    int numPoolRejects;		// pages it had no use or room for
+    int numPoolBytes;		// their total size, compressed
+    int numPoolHits;		// pages read back from the pool
+    int numCOWCopies;		// shared pages copied on the first write
+    int numTextShares;		// code page faults served by mapping
+				// another instance's frame
+    int numPrefetched;		// pages read ahead of a page fault
+    int numPrefetchHits;	// of those, pages the program then used
+    int numPrefetchMisses;	// and pages it did not
+    int numResumePrefetched;	// pages of a working set brought back
+				// when its process ran again
+    int numTLBHits;		// number of translations found in the TLB
+    int numTLBMisses;		// number of translations not found there
     int numPacketsSent;		// number of packets sent over the network
     int numPacketsRecvd;	// number of packets received over the network
+    int faultLatency[NumLatencyBuckets];
+				// page faults by how long they took
 
     Statistics(); 		// initialize everything to zero
 
+    void RecordFaultLatency(int ticks);
+				// count a page fault that took "ticks"
     void Print();		// print collected statistics
+
+    void Checkpoint(int fd);	// write the statistics to a checkpoint
+    void Restore(int fd);	// read them back from one
 };
 
 // Constants used to reflect the relative time an operation would
@@ -48,13 +88,17 @@ class Statistics {
 // Since Nachos kernel code is directly executed, and the time spent
 // in the kernel measured by the number of calls to enable interrupts,
 // these time constants are none too exact.
+//
+// The cost model is part of the machine profile: the defaults are in
+// stats.cc, and may be changed at startup.
 
-const int UserTick = 	   1;	// advance for each user-level instruction 
-const int SystemTick =	  10; 	// advance each time interrupts are enabled
-const int RotationTime = 500; 	// time disk takes to rotate one sector
-const int SeekTime =	 500;  	// time disk takes to seek past one track
-const int ConsoleTime =	 100;	// time to read or write one character
-const int NetworkTime =	 100;  	// time to send or receive one packet
-const int TimerTicks = 	 100;  	// (average) time between timer interrupts
+extern int UserTick;		// advance for each user-level instruction 
+extern int SystemTick;		// advance each time interrupts are enabled
+extern int RotationTime;	// time disk takes to rotate one sector
+extern int SeekTime;		// time disk takes to seek past one track
+extern int SwapTime;		// time to read or write one page of swap
+extern int ConsoleTime;		// time to read or write one character
+extern int NetworkTime;		// time to send or receive one packet
+extern int TimerTicks;		// (average) time between timer interrupts
 
 #endif // STATS_H
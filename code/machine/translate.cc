@@ -84,34 +84,42 @@ ShortToMachine(unsigned short shortword) { return ShortToHost(shortword); }
 
 bool
 Machine::ReadMem(int addr, int size, int *value) {
-    cout << "Reading virtual address " << addr << endl;
     int data;
     ExceptionType exception;
     int physicalAddress;
-
-    DEBUG(dbgAddr, "Reading VA " << addr << ", size " << size);
-
-    exception = Translate(addr, &physicalAddress, size, FALSE);
-    if (exception != NoException) {
-        RaiseException(exception, addr);
-        //如果是缺页，则抛出缺页异常以后再度translate
-        if (exception == PageFaultException)
-            Translate(addr, &physicalAddress, size, FALSE);
-        else return FALSE;
+    char *host;
+
+    perfCounters[PerfLoads]++;
+    host = FastLookup(addr, size, FALSE);
+    if (host == NULL) {
+        TRACE(dbgAddr, TraceAccesses, "read VA %d, size %d", addr, size);
+        DEBUG(dbgAddr, "Reading VA " << addr << ", size " << size);
+
+        exception = Translate(addr, &physicalAddress, size, FALSE);
+        if (exception != NoException) {
+            RaiseException(exception, addr);
+            //如果是缺页（或TLB缺失），则抛出异常以后再度translate
+            if ((exception != PageFaultException
+                 && exception != TLBMissException)
+                || Translate(addr, &physicalAddress, size, FALSE) != NoException)
+                return FALSE;
+        }
+        RecordTranslation(addr, physicalAddress);
+        host = &mainMemory[physicalAddress];
     }
     switch (size) {
         case 1:
-            data = mainMemory[physicalAddress];
+            data = *host;
             *value = data;
             break;
 
         case 2:
-            data = *(unsigned short *) &mainMemory[physicalAddress];
+            data = *(unsigned short *) host;
             *value = ShortToHost(data);
             break;
 
         case 4:
-            data = *(unsigned int *) &mainMemory[physicalAddress];
+            data = *(unsigned int *) host;
             *value = WordToHost(data);
             break;
 
@@ -138,42 +146,165 @@ Machine::ReadMem(int addr, int size, int *value) {
 
 bool
 Machine::WriteMem(int addr, int size, int value) {
-    cout << "Writing to virtual address " << addr << endl;
     ExceptionType exception;
     int physicalAddress;
-
-    DEBUG(dbgAddr, "Writing VA " << addr << ", size " << size << ", value " << value);
-
-    exception = Translate(addr, &physicalAddress, size, TRUE);
-    if (exception != NoException) {
-        RaiseException(exception, addr);
-        // 如果是缺页，则抛出缺页异常以后再度translate
-        if (exception == PageFaultException)
-            Translate(addr, &physicalAddress, size, TRUE);
-        else return FALSE;
+    char *host;
+
+    perfCounters[PerfStores]++;
+    host = FastLookup(addr, size, TRUE);
+    if (host == NULL) {
+        TRACE(dbgAddr, TraceAccesses, "write VA %d, size %d, value %d",
+              addr, size, value);
+        DEBUG(dbgAddr, "Writing VA " << addr << ", size " << size << ", value " << value);
+
+        exception = Translate(addr, &physicalAddress, size, TRUE);
+        if (exception != NoException) {
+            RaiseException(exception, addr);
+            // 如果是缺页（或TLB缺失，或写时复制），则抛出异常以后再度translate
+            if ((exception != PageFaultException
+                 && exception != TLBMissException
+                 && exception != ReadOnlyException)
+                || Translate(addr, &physicalAddress, size, TRUE) != NoException)
+                return FALSE;
+        }
+        RecordTranslation(addr, physicalAddress);
+        host = &mainMemory[physicalAddress];
     }
+    physicalAddress = host - mainMemory;
     switch (size) {
         case 1:
-            mainMemory[physicalAddress] = (unsigned char) (value & 0xff);
+            *host = (unsigned char) (value & 0xff);
             break;
 
         case 2:
-            *(unsigned short *) &mainMemory[physicalAddress]
+            *(unsigned short *) host
                     = ShortToMachine((unsigned short) (value & 0xffff));
             break;
 
         case 4:
-            *(unsigned int *) &mainMemory[physicalAddress]
+            *(unsigned int *) host
                     = WordToMachine((unsigned int) value);
             break;
 
         default:
             ASSERT(FALSE);
     }
+    // the word may hold code: make sure it is decoded (and any block
+    // translated from it) afresh
+    if (decodedPages[physicalAddress / PageSize] != NULL) {
+        Instruction *cached =
+                &decodedPages[physicalAddress / PageSize][(physicalAddress % PageSize) / 4];
+        if (cached->opCode != 0) {
+            cached->opCode = 0;
+            frameGeneration[physicalAddress / PageSize]++;
+        }
+    }
 
     return TRUE;
 }
 
+//----------------------------------------------------------------------
+// Machine::FastLookup
+// 	Look "virtAddr" up in the translation cache.  Return where it
+//	is in mainMemory if the cache has a translation for the page in
+//	the current page table that allows this access, and the access
+//	is aligned; otherwise return NULL, and the caller must go through
+//	Translate (which reports any exception).
+//
+//	"size" -- the amount of memory being read or written
+// 	"writing" -- if TRUE, the access is a write
+//----------------------------------------------------------------------
+
+char *
+Machine::FastLookup(int virtAddr, int size, bool writing) {
+    unsigned int vpn = (unsigned) virtAddr / PageSize;
+    FastTranslation *fast = &fastTLB[vpn % FastTLBSize];
+
+    if (fast->vpn != vpn || fast->space != pageTable
+        || (virtAddr & (size - 1)) != 0
+        || !(writing ? fast->canWrite : fast->canRead))
+        return NULL;
+    fast->hits++;
+    return fast->host + (unsigned) virtAddr % PageSize;
+}
+
+//----------------------------------------------------------------------
+// Machine::RecordTranslation
+// 	Remember in the translation cache that "virtAddr" was just
+//	translated to "physAddr" with the current page table.  Only the
+//	linear page table is cached: a software-loaded TLB is managed by
+//	the kernel, which must see every miss.
+//----------------------------------------------------------------------
+
+void
+Machine::RecordTranslation(int virtAddr, int physAddr) {
+    unsigned int vpn = (unsigned) virtAddr / PageSize;
+    FastTranslation *fast = &fastTLB[vpn % FastTLBSize];
+    TranslationEntry *entry;
+
+    if (tlb != NULL)
+        return;
+    entry = pageTable->Lookup(vpn);
+    if (fast->vpn != NoFastVpn)
+        TouchFrame(fast->frame, fast->hits);
+    fast->space = pageTable;
+    fast->vpn = vpn;
+    fast->frame = physAddr / PageSize;
+    fast->host = &mainMemory[fast->frame * PageSize];
+    fast->canRead = TRUE;
+    fast->canWrite = !entry->readOnly && entry->dirty;
+    fast->hits = 0;
+}
+
+//----------------------------------------------------------------------
+// Machine::InvalidateFastTLB
+// 	Drop every cached translation to physical page "frame", e.g.
+//	because the kernel is evicting the page held in it.
+//----------------------------------------------------------------------
+
+void
+Machine::InvalidateFastTLB(int frame) {
+    for (int i = 0; i < FastTLBSize; i++) {
+        if (fastTLB[i].vpn != NoFastVpn && fastTLB[i].frame == frame) {
+            TouchFrame(frame, fastTLB[i].hits);
+            fastTLB[i].vpn = NoFastVpn;
+            fastTLB[i].space = NULL;
+            fastTLB[i].hits = 0;
+        }
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::FlushFastTLB
+// 	Drop all cached translations, e.g. on a context switch.
+//----------------------------------------------------------------------
+
+void
+Machine::FlushFastTLB() {
+    SyncUseStamps();
+    for (int i = 0; i < FastTLBSize; i++) {
+        fastTLB[i].vpn = NoFastVpn;
+        fastTLB[i].space = NULL;
+    }
+}
+
+//----------------------------------------------------------------------
+// Machine::SyncUseStamps
+// 	Add the accesses made through the translation cache to the
+//	useStamps of the frames they touched, and move those to the tail
+//	of the LRU list, so that the LRU replacement sees every access.
+//----------------------------------------------------------------------
+
+void
+Machine::SyncUseStamps() {
+    for (int i = 0; i < FastTLBSize; i++) {
+        if (fastTLB[i].vpn != NoFastVpn) {
+            TouchFrame(fastTLB[i].frame, fastTLB[i].hits);
+        }
+        fastTLB[i].hits = 0;
+    }
+}
+
 //----------------------------------------------------------------------
 // Machine::Translate
 // 	Translate a virtual address into a physical address, using 
@@ -202,12 +333,13 @@ Machine::Translate(int virtAddr, int *physAddr, int size, bool writing) {
 // check for alignment errors
     if (((size == 4) && (virtAddr & 0x3)) || ((size == 2) && (virtAddr & 0x1))) {
         DEBUG(dbgAddr, "Alignment problem at " << virtAddr << ", size " << size);
-        cout << "alignment problem at " << virtAddr << ", size " << size << endl;
+        TRACE(dbgAddr, TraceEvents, "alignment problem at %d, size %d",
+              virtAddr, size);
         return AddressErrorException;
     }
 
-    // we must have either a TLB or a page table, but not both!
-    ASSERT(tlb == NULL || pageTable == NULL);
+    // we must have either a TLB or a page table; if we have a TLB,
+    // any page table is the kernel's business
     ASSERT(tlb != NULL || pageTable != NULL);
 
 // calculate the virtual page number, and offset within the page,
@@ -218,28 +350,33 @@ Machine::Translate(int virtAddr, int *physAddr, int size, bool writing) {
     if (tlb == NULL) {        // => page table => vpn is index into table
         if (vpn >= pageTableSize) {
             DEBUG(dbgAddr, "Illegal virtual page # " << virtAddr);
-            cout << "virtual page " << vpn << " is larger than total page num with address " << virtAddr << " !"
-                 << endl;
+            TRACE(dbgAddr, TraceEvents, "illegal virtual page %d at %d",
+                  vpn, virtAddr);
             return AddressErrorException;
-        } else if (!pageTable[vpn].valid || pageTable[vpn].physicalPage == -1) {
+        }
+        entry = pageTable->Lookup(vpn);
+        if (entry == NULL || !entry->valid || entry->physicalPage == -1) {
             DEBUG(dbgAddr, "Invalid virtual page # " << virtAddr);
             //cout << "valid bit is FALSE or -1 memory address and cause a page fault at vpn: " << vpn << endl;
             return PageFaultException;
         }
-        entry = &pageTable[vpn];
-    } else {
-        for (entry = NULL, i = 0; i < TLBSize; i++)
-            if (tlb[i].valid && (tlb[i].virtualPage == ((int) vpn))) {
-                entry = &tlb[i];            // FOUND!
+    } else {                  // => TLB => search the set vpn maps to
+        TranslationEntry *set = &tlb[(vpn % (TLBSize / TLBWays)) * TLBWays];
+
+        for (entry = NULL, i = 0; i < TLBWays; i++)
+            if (set[i].valid && (set[i].virtualPage == ((int) vpn))
+                && set[i].asid == asid) {
+                entry = &set[i];            // FOUND!
                 break;
             }
         if (entry == NULL) {                // not found
             DEBUG(dbgAddr, "Invalid TLB entry for this virtual page!");
-            cout << "fetched entry is null and cause a page fault!" << endl;
-            return PageFaultException;        // really, this is a TLB fault,
-            // the page may be in memory,
+            TRACE(dbgAddr, TraceEvents, "TLB miss on virtual page %d", vpn);
+            kernel->stats->numTLBMisses++;
+            return TLBMissException;        // the page may be in memory,
             // but not in the TLB
         }
+        kernel->stats->numTLBHits++;
     }
 
     if (entry->readOnly && writing) {    // trying to write to a read-only page
@@ -250,7 +387,7 @@ Machine::Translate(int virtAddr, int *physAddr, int size, bool writing) {
 
     // if the pageFrame is too big, there is something really wrong! 
     // An invalid translation was loaded into the page table or TLB. 
-    if (pageFrame >= NumPhysPages) {
+    if (pageFrame >= (unsigned) NumPhysPages) {
         DEBUG(dbgAddr, "Illegal pageframe " << pageFrame);
         return BusErrorException;
     }
@@ -260,9 +397,145 @@ Machine::Translate(int virtAddr, int *physAddr, int size, bool writing) {
         entry->dirty = TRUE;
     *physAddr = pageFrame * PageSize + offset;
 
-    GlobalPageTable[*physAddr / PageSize].useStamp += 1;
+    if (replacement == LRUReplacement)
+        TouchFrame(*physAddr / PageSize, 1);
     ASSERT((*physAddr >= 0) && ((*physAddr + size) <= MemorySize));
     DEBUG(dbgAddr, "phys addr = " << *physAddr);
-    cout << "translating from virtual address " << virtAddr << " to " << *physAddr << endl;
+    TRACE(dbgAddr, TraceAccesses, "translate VA %d to PA %d",
+          virtAddr, *physAddr);
     return NoException;
 }
+
+//----------------------------------------------------------------------
+// PageTable::PageTable
+// 	Initialize an empty page table for virtual pages 0..nPages-1.
+//	Only the directory is allocated here; second-level tables are
+//	allocated by Entry as pages are mapped.
+//----------------------------------------------------------------------
+
+PageTable::PageTable(int nPages)
+{
+    numPages = nPages;
+    numSlots = divRoundUp(nPages, PageTableFanout);
+    directory = new TranslationEntry *[numSlots];
+    for (int i = 0; i < numSlots; i++)
+        directory[i] = NULL;
+    diskFile = NULL;
+    resident = 0;
+}
+
+//----------------------------------------------------------------------
+// PageTable::~PageTable
+// 	De-allocate the directory and every second-level table.
+//----------------------------------------------------------------------
+
+PageTable::~PageTable()
+{
+    for (int i = 0; i < numSlots; i++)
+        delete [] directory[i];
+    delete [] directory;
+}
+
+//----------------------------------------------------------------------
+// PageTable::Entry
+// 	Return the entry for virtual page "vpn", allocating the
+//	second-level table that covers it if this is the first page
+//	mapped in its range.  New entries are invalid, with no frame.
+//----------------------------------------------------------------------
+
+TranslationEntry *
+PageTable::Entry(int vpn)
+{
+    TranslationEntry **slot;
+
+    ASSERT(vpn >= 0 && vpn < numPages);
+    slot = &directory[vpn / PageTableFanout];
+    if (*slot == NULL) {
+        int base = vpn - vpn % PageTableFanout;
+
+        *slot = new TranslationEntry[PageTableFanout];
+        for (int i = 0; i < PageTableFanout; i++) {
+            (*slot)[i].virtualPage = base + i;
+            (*slot)[i].physicalPage = -1;
+            (*slot)[i].valid = FALSE;
+            (*slot)[i].readOnly = FALSE;
+            (*slot)[i].use = FALSE;
+            (*slot)[i].dirty = FALSE;
+            (*slot)[i].asid = -1;
+            (*slot)[i].DiskFile = diskFile;
+            (*slot)[i].swapSlot = -1;
+            (*slot)[i].cow = FALSE;
+        }
+    }
+    return &(*slot)[vpn % PageTableFanout];
+}
+
+//----------------------------------------------------------------------
+// PageTable::NextMapped
+// 	Return the first virtual page, from "vpn" on, covered by a
+//	second-level table, or Size() if there is none.  Pages without a
+//	table were never mapped, so walks over the whole address space
+//	(e.g. to tear it down) can skip them a table at a time.
+//----------------------------------------------------------------------
+
+int
+PageTable::NextMapped(int vpn)
+{
+    int slot;
+
+    if (vpn >= numPages)
+        return numPages;
+    slot = vpn / PageTableFanout;
+    if (directory[slot] != NULL)
+        return vpn;
+    for (slot++; slot < numSlots; slot++) {
+        if (directory[slot] != NULL)
+            return slot * PageTableFanout;
+    }
+    return numPages;
+}
+
+//----------------------------------------------------------------------
+// PageTable::Checkpoint
+// 	Write the allocated second-level tables to "fd", each preceded by
+//	its directory slot and ended by a slot of -1.  The DiskFile
+//	pointers are not written: Restore points them at diskFile.
+//----------------------------------------------------------------------
+
+void
+PageTable::Checkpoint(int fd)
+{
+    int end = -1;
+
+    for (int i = 0; i < numSlots; i++) {
+        if (directory[i] != NULL) {
+            WriteFile(fd, (char *) &i, sizeof(int));
+            WriteFile(fd, (char *) directory[i],
+                      PageTableFanout * sizeof(TranslationEntry));
+        }
+    }
+    WriteFile(fd, (char *) &end, sizeof(int));
+}
+
+//----------------------------------------------------------------------
+// PageTable::Restore
+// 	Read tables written by Checkpoint back into this (empty) table.
+//----------------------------------------------------------------------
+
+void
+PageTable::Restore(int fd)
+{
+    int slot;
+
+    for (;;) {
+        Read(fd, (char *) &slot, sizeof(int));
+        if (slot < 0)
+            break;
+        ASSERT(slot < numSlots && directory[slot] == NULL);
+        directory[slot] = new TranslationEntry[PageTableFanout];
+        Read(fd, (char *) directory[slot],
+             PageTableFanout * sizeof(TranslationEntry));
+        for (int i = 0; i < PageTableFanout; i++)
+            directory[slot][i].DiskFile = diskFile;
+    }
+}
@@ -40,9 +40,57 @@ class TranslationEntry {
 			// page is referenced or modified.
     bool dirty;         // This bit is set by the hardware every time the
 			// page is modified.
+    int asid;		// TLB entries only: the address space the
+			// mapping belongs to.
 
     //添加一个用于存储加载程序的程序名称
     char* DiskFile;
+    int swapSlot;	// Page tables only: where the page was last
+			// written in swap, or -1 if it never was.
+    bool cow;		// Page tables only: the page is shared with
+			// another address space, and is read-only until
+			// it is copied on the first write.
+};
+
+// The following class defines a page table: the mapping for every
+// virtual page of one address space.  It is kept in two levels so that
+// a large, sparse address space (code and heap near address 0, the
+// stack near the top) only pays for the parts it actually uses: the
+// directory has one slot per PageTableFanout virtual pages, and the
+// second-level table for a slot is only allocated when a page in its
+// range is first mapped.
+
+const int PageTableFanout = 64;		// entries per second-level table
+
+class PageTable {
+  public:
+    PageTable(int nPages);		// an empty table for virtual pages
+					// 0..nPages-1
+    ~PageTable();			// free every second-level table
+
+    TranslationEntry *Lookup(int vpn)	// what the hardware walks: NULL if
+    {					// no table covers vpn yet
+	TranslationEntry *table = directory[vpn / PageTableFanout];
+	return (table == NULL) ? NULL : &table[vpn % PageTableFanout];
+    }
+    TranslationEntry *Entry(int vpn);	// same, allocating the second-level
+					// table if need be
+    int Size() { return numPages; }
+    int NextMapped(int vpn);		// first page from vpn on that has a
+					// table, or Size() if none does
+
+    char *diskFile;			// executable new entries are loaded from
+    int resident;			// frames mapped, kept up to date by
+					// the machine as they are handed out
+
+    void Checkpoint(int fd);		// write the allocated tables to fd
+    void Restore(int fd);		// and read them back into an empty
+					// table of the same size
+
+  private:
+    TranslationEntry **directory;	// one second-level table per slot
+    int numPages;
+    int numSlots;
 };
 
 #endif
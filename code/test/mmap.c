@@ -0,0 +1,91 @@
+/* mmap.c
+ *	Simple program to test memory-mapped files.
+ *
+ *	Create an empty scratch file, map its first bytes read-write, and
+ *	check that they read as zeroes.  Fill them with a pattern and
+ *	unmap the file, which writes the changed page back to it.  Then
+ *	map it again, read-only, and check that the pattern is there.
+ *
+ *	The page faults taken while touching the mapping are counted
+ *	with PerfCounter.  Every run starts from a fresh scratch file.
+ */
+
+#include "syscall.h"
+
+#define SCRATCH	"mmap.scratch"
+#define LENGTH	32	/* bytes of the file mapped */
+
+void
+Print(char *s)
+{
+    int n;
+
+    for (n = 0; s[n] != '\0'; n++)
+	;
+    Write(s, n, ConsoleOutput);
+}
+
+void
+PrintNumber(int n)
+{
+    char digits[12];
+    int i = 11;
+
+    digits[i] = '\0';
+    do {
+	digits[--i] = '0' + n % 10;
+	n /= 10;
+    } while (n > 0);
+    Print(&digits[i]);
+}
+
+void
+Fail(char *why)
+{
+    Print("mmap: ");
+    Print(why);
+    Print("\n");
+    Halt();
+}
+
+int
+main()
+{
+    char *p;
+    int i, faults;
+
+    if (Create(SCRATCH) < 0)
+	Fail("can't create the scratch file");
+    p = (char *) Mmap(SCRATCH, 0, LENGTH, RW);
+    if ((int) p == -1)
+	Fail("can't map the scratch file");
+
+    faults = PerfCounter(PERF_PAGE_FAULTS);
+    for (i = 0; i < LENGTH; i++) {
+	if (p[i] != 0)
+	    Fail("a new file doesn't read as zeroes");
+	p[i] = 'a' + i % 26;
+    }
+    Print("mmap: page faults touching the mapping: ");
+    PrintNumber(PerfCounter(PERF_PAGE_FAULTS) - faults);
+    Print("\n");
+
+    if (Munmap((int) p) != 0)
+	Fail("Munmap failed");
+    if (Munmap((int) p) != -1)
+	Fail("Munmap of an unmapped address succeeded");
+
+    /* the pattern should have reached the file */
+    p = (char *) Mmap(SCRATCH, 0, LENGTH, RO);
+    if ((int) p == -1)
+	Fail("can't map the scratch file again");
+    for (i = 0; i < LENGTH; i++) {
+	if (p[i] != 'a' + i % 26)
+	    Fail("the mapping was not written back");
+    }
+    Munmap((int) p);
+
+    Print("mmap: ok\n");
+    Halt();
+    /* not reached */
+}
@@ -218,6 +218,30 @@ Clock:
 	j       $31
 	.end Clock
 
+	.globl PerfCounter
+	.ent   PerfCounter
+PerfCounter:
+	addiu $2,$0,SC_PerfCounter
+	syscall
+	j       $31
+	.end PerfCounter
+
+	.globl Mmap
+	.ent   Mmap
+Mmap:
+	addiu $2,$0,SC_Mmap
+	syscall
+	j       $31
+	.end Mmap
+
+	.globl Munmap
+	.ent   Munmap
+Munmap:
+	addiu $2,$0,SC_Munmap
+	syscall
+	j       $31
+	.end Munmap
+
 /* dummy function to keep gcc happy */
         .globl  __main
         .ent    __main
@@ -15,8 +15,58 @@
 #include "libtest.h"
 #include "string.h"
 #include "synchconsole.h"
+#include "swap.h"
+#include "pageout.h"
 #include "synchdisk.h"
 #include "post.h"
+#include "addrspace.h"
+
+// The machine profile: the parameters of the simulated hardware that
+// can be set at startup, by name, with -M or from a file given with -P.
+// They must all be set before the machine and devices are created.
+
+static struct {
+    const char *name;
+    int *value;
+} machineParameters[] = {
+    { "NumPhysPages", &NumPhysPages },
+    { "PageSize", &PageSize },
+    { "TLBSize", &TLBSize },
+    { "TLBWays", &TLBWays },
+    { "VirtualPages", &VirtualPages },
+    { "DemandPaging", &DemandPaging },
+    { "ReadaheadPages", &ReadaheadPages },
+    { "MmapPages", &MmapPages },
+    { "HandSpread", &HandSpread },
+    { "SwapPages", &SwapPages },
+    { "CompressedPages", &CompressedPages },
+    { "FreeLowWater", &FreeLowWater },
+    { "FreeHighWater", &FreeHighWater },
+    { "PrecleanPages", &PrecleanPages },
+    { "MinResidentPages", &MinResidentPages },
+    { "FaultIntervalLow", &FaultIntervalLow },
+    { "FaultIntervalHigh", &FaultIntervalHigh },
+    { "ResumePrefetchPages", &ResumePrefetchPages },
+    { "WorkingSetWindow", &WorkingSetWindow },
+    { "SectorsPerTrack", &SectorsPerTrack },
+    { "NumTracks", &NumTracks },
+    { "UserTick", &UserTick },
+    { "SystemTick", &SystemTick },
+    { "RotationTime", &RotationTime },
+    { "SeekTime", &SeekTime },
+    { "SwapTime", &SwapTime },
+    { "ConsoleTime", &ConsoleTime },
+    { "NetworkTime", &NetworkTime },
+    { "TimerTicks", &TimerTicks },
+};
+
+const int NumMachineParameters =
+	sizeof(machineParameters) / sizeof(machineParameters[0]);
+
+// Written at the start of a checkpoint file, to make it less likely we
+// treat some other file as one.
+
+const int CheckpointMagic = 0x4e436b70;
 
 //----------------------------------------------------------------------
 // Kernel::Kernel
@@ -28,6 +78,9 @@ Kernel::Kernel(int argc, char **argv)
 {
     randomSlice = FALSE; 
     debugUserProg = FALSE;
+    engine = ThreadedEngine;
+    replacement = LRUReplacement;
+    checkpointFile = NULL;
     consoleIn = NULL;          // default is stdin
     consoleOut = NULL;         // default is stdout
 #ifndef FILESYS_STUB
@@ -45,6 +98,47 @@ Kernel::Kernel(int argc, char **argv)
 	    i++;
         } else if (strcmp(argv[i], "-s") == 0) {
             debugUserProg = TRUE;
+        } else if (strcmp(argv[i], "-P") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is the profile file
+            LoadProfile(argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "-M") == 0) {
+            ASSERT(i + 2 < argc);   // next arguments are name and value
+            if (!SetParameter(argv[i + 1], atoi(argv[i + 2]))) {
+                cout << "Unknown machine parameter " << argv[i + 1] << "\n";
+            }
+            i += 2;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            ASSERT(i + 2 < argc);   // next arguments are file and time
+            checkpointFile = argv[i + 1];
+            checkpointTime = atoi(argv[i + 2]);
+            i += 2;
+        } else if (strcmp(argv[i], "-E") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is the engine name
+            if (strcmp(argv[i + 1], "switch") == 0) {
+                engine = SwitchEngine;
+            } else if (strcmp(argv[i + 1], "threaded") == 0) {
+                engine = ThreadedEngine;
+            } else if (strcmp(argv[i + 1], "block") == 0) {
+                engine = BlockEngine;
+            } else {
+                cout << "Unknown execution engine " << argv[i + 1] << "\n";
+            }
+            i++;
+        } else if (strcmp(argv[i], "-V") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is the policy name
+            if (strcmp(argv[i + 1], "lru") == 0) {
+                replacement = LRUReplacement;
+            } else if (strcmp(argv[i + 1], "clock") == 0) {
+                replacement = ClockReplacement;
+            } else if (strcmp(argv[i + 1], "2clock") == 0) {
+                replacement = TwoHandClockReplacement;
+            } else if (strcmp(argv[i + 1], "wsclock") == 0) {
+                replacement = WSClockReplacement;
+            } else {
+                cout << "Unknown replacement policy " << argv[i + 1] << "\n";
+            }
+            i++;
 	} else if (strcmp(argv[i], "-ci") == 0) {
 	    ASSERT(i + 1 < argc);
 	    consoleIn = argv[i + 1];
@@ -67,7 +161,9 @@ Kernel::Kernel(int argc, char **argv)
             i++;
         } else if (strcmp(argv[i], "-u") == 0) {
             cout << "Partial usage: nachos [-rs randomSeed]\n";
-	    cout << "Partial usage: nachos [-s]\n";
+	    cout << "Partial usage: nachos [-s] [-E switch|threaded|block]\n";
+	    cout << "Partial usage: nachos [-P profileFile] [-M parameter value]\n";
+	    cout << "Partial usage: nachos [-S checkpointFile time]\n";
             cout << "Partial usage: nachos [-ci consoleIn] [-co consoleOut]\n";
 #ifndef FILESYS_STUB
 	    cout << "Partial usage: nachos [-nf]\n";
@@ -75,6 +171,80 @@ Kernel::Kernel(int argc, char **argv)
             cout << "Partial usage: nachos [-n #] [-m #]\n";
 	}
     }
+
+    // the simulation needs at least this much to make sense
+    ASSERT(NumPhysPages > 0 && TLBSize > 0);
+    ASSERT(TLBWays > 0 && TLBSize % TLBWays == 0);
+    ASSERT(PageSize > 0 && PageSize % 4 == 0);	// whole instructions
+    ASSERT(VirtualPages >= 0);
+    ASSERT(HandSpread >= 0 && WorkingSetWindow >= 0);
+    ASSERT(SwapPages > 0 && ReadaheadPages >= 0);
+    ASSERT(MmapPages >= 0);
+    ASSERT(CompressedPages >= 0);
+    ASSERT(FreeLowWater >= 0 && FreeHighWater >= FreeLowWater);
+    ASSERT(FreeHighWater < NumPhysPages && PrecleanPages >= 0);
+    ASSERT(MinResidentPages > 0 && MinResidentPages <= NumPhysPages);
+    ASSERT(FaultIntervalLow >= 0 && FaultIntervalHigh > FaultIntervalLow);
+    ASSERT(ResumePrefetchPages >= 0);
+    ASSERT(SectorsPerTrack > 0 && NumTracks > 0);
+    ASSERT(UserTick > 0 && SystemTick > 0 && TimerTicks > 0);
+    ASSERT(RotationTime >= 0 && SeekTime >= 0 && SwapTime >= 0);
+    ASSERT(ConsoleTime > 0 && NetworkTime > 0);
+}
+
+//----------------------------------------------------------------------
+// Kernel::LoadProfile
+// 	Set machine parameters from the UNIX file "fileName".  Each line
+//	holds a parameter name and its value, e.g.
+//
+//		NumPhysPages 512
+//		SeekTime 2000
+//
+//	Blank lines, and lines starting with '#', are ignored.
+//----------------------------------------------------------------------
+
+void
+Kernel::LoadProfile(char *fileName)
+{
+    FILE *profile = fopen(fileName, "r");
+    char line[200], name[100];
+    int value;
+
+    if (profile == NULL) {
+        cerr << "Can't open machine profile " << fileName << "\n";
+        Abort();
+    }
+    while (fgets(line, sizeof(line), profile) != NULL) {
+        if (sscanf(line, "%99s", name) != 1 || name[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%99s %d", name, &value) != 2
+                || !SetParameter(name, value)) {
+            cerr << "Bad line in machine profile " << fileName << ": "
+                 << line;
+            Abort();
+        }
+    }
+    fclose(profile);
+}
+
+//----------------------------------------------------------------------
+// Kernel::SetParameter
+// 	Set the machine parameter called "name" to "value".  Returns
+//	FALSE if there is no such parameter.
+//----------------------------------------------------------------------
+
+bool
+Kernel::SetParameter(const char *name, int value)
+{
+    for (int i = 0; i < NumMachineParameters; i++) {
+        if (strcmp(machineParameters[i].name, name) == 0) {
+            *machineParameters[i].value = value;
+            DEBUG(dbgMach, "Machine parameter " << name << " = " << value);
+            return TRUE;
+        }
+    }
+    return FALSE;
 }
 
 //----------------------------------------------------------------------
@@ -97,7 +267,7 @@ Kernel::Initialize()
     interrupt = new Interrupt;		// start up interrupt handling
     scheduler = new Scheduler();	// initialize the ready queue
     alarm = new Alarm(randomSlice);	// start up time slicing
-    machine = new Machine(debugUserProg);
+    machine = new Machine(debugUserProg, engine, replacement);
     synchConsoleIn = new SynchConsoleInput(consoleIn); // input from stdin
     synchConsoleOut = new SynchConsoleOutput(consoleOut); // output to stdout
     synchDisk = new SynchDisk();    //
@@ -106,12 +276,125 @@ Kernel::Initialize()
 #else
     fileSystem = new FileSystem(formatFlag);
 #endif // FILESYS_STUB
+    swapSpace = new SwapSpace(SwapPages);
+    pageout = new PageoutDaemon();
     postOfficeIn = new PostOfficeInput(10);
     postOfficeOut = new PostOfficeOutput(reliability);
+    if (checkpointFile != NULL) {
+        new CheckpointAlarm(checkpointFile, checkpointTime);
+    }
 
     interrupt->Enable();
 }
 
+//----------------------------------------------------------------------
+// Kernel::SaveCheckpoint
+// 	Save the state of the running user program in the UNIX file
+//	"fileName": the machine profile it depends on, statistics,
+//	registers, memory and page tables, the pages in swap, the
+//	current address space, and the pending interrupts.
+//
+//	Only a single user program is saved, between two of its
+//	instructions, with no other thread ready and no device operation
+//	in progress; CheckpointAlarm waits for such a moment.  Kernel
+//	threads can't be saved, since their state is on host stacks.
+//----------------------------------------------------------------------
+
+void
+Kernel::SaveCheckpoint(char *fileName)
+{
+    int fd = OpenForWrite(fileName);
+    int header[4];
+
+    header[0] = CheckpointMagic;
+    header[1] = NumPhysPages;
+    header[2] = PageSize;
+    header[3] = NumTotalRegs;
+    WriteFile(fd, (char *) header, sizeof(header));
+    stats->Checkpoint(fd);
+    machine->Checkpoint(fd);
+    swapSpace->Checkpoint(fd);
+    currentThread->space->Checkpoint(fd);
+    interrupt->Checkpoint(fd);
+    Close(fd);
+    DEBUG(dbgMach, "Checkpoint saved in " << fileName << " at time "
+                    << stats->totalTicks);
+}
+
+//----------------------------------------------------------------------
+// Kernel::Resume
+// 	Restore the user program saved in the checkpoint "fileName", in
+//	place of loading one, and run it.  The machine must have been
+//	given the same memory size as when the checkpoint was saved.
+//	Never returns.
+//----------------------------------------------------------------------
+
+void
+Kernel::Resume(char *fileName)
+{
+    int fd = OpenForReadWrite(fileName, FALSE);
+    int header[4];
+    AddrSpace *space;
+
+    if (fd < 0) {
+        cerr << "Can't open checkpoint " << fileName << "\n";
+        Abort();
+    }
+    Read(fd, (char *) header, sizeof(header));
+    if (header[0] != CheckpointMagic || header[1] != NumPhysPages
+            || header[2] != PageSize || header[3] != NumTotalRegs) {
+        cerr << fileName << " is not a checkpoint for this machine profile\n";
+        Abort();
+    }
+    stats->Restore(fd);
+    machine->Restore(fd);
+    swapSpace->Restore(fd);
+    space = new AddrSpace;
+    space->Restore(fd);
+    interrupt->Restore(fd);
+    Close(fd);
+
+    currentThread->space = space;
+    machine->Run();		// continue the user program
+
+    ASSERTNOTREACHED();
+}
+
+//----------------------------------------------------------------------
+// CheckpointAlarm::CheckpointAlarm
+// 	Arrange for a checkpoint to be saved in "fileName" when simulated
+//	time reaches "when".
+//----------------------------------------------------------------------
+
+CheckpointAlarm::CheckpointAlarm(char *fileName, int when)
+{
+    this->fileName = fileName;
+    kernel->interrupt->Schedule(this, when - kernel->stats->totalTicks,
+                                CheckpointInt);
+}
+
+//----------------------------------------------------------------------
+// CheckpointAlarm::CallBack
+// 	The checkpoint is due.  Save it if a user program is running and
+//	has just finished an instruction (we are called from the tick
+//	that follows it), the only runnable thread, and no device
+//	operation is in progress.  Otherwise try again a little later.
+//----------------------------------------------------------------------
+
+void
+CheckpointAlarm::CallBack()
+{
+    if (kernel->interrupt->getStatus() != UserMode
+            || kernel->currentThread->space == NULL
+            || !kernel->scheduler->IsEmpty()
+            || !kernel->interrupt->CanCheckpoint()) {
+        kernel->interrupt->Schedule(this, TimerTicks, CheckpointInt);
+        return;
+    }
+    kernel->SaveCheckpoint(fileName);
+    delete this;
+}
+
 //----------------------------------------------------------------------
 // Kernel::~Kernel
 // 	Nachos is halting.  De-allocate global data structures.
@@ -127,6 +410,8 @@ Kernel::~Kernel()
     delete synchConsoleIn;
     delete synchConsoleOut;
     delete synchDisk;
+    delete pageout;
+    delete swapSpace;
     delete fileSystem;
     delete postOfficeIn;
     delete postOfficeOut;
@@ -24,6 +24,22 @@ class PostOfficeOutput;
 class SynchConsoleInput;
 class SynchConsoleOutput;
 class SynchDisk;
+class SwapSpace;
+class PageoutDaemon;
+
+// Takes a checkpoint of the running user program when its interrupt
+// fires (see Kernel::SaveCheckpoint).
+
+class CheckpointAlarm : public CallBackObj {
+  public:
+    CheckpointAlarm(char *fileName, int when);
+				// checkpoint to "fileName" at time "when"
+
+  private:
+    char *fileName;		// where to save the checkpoint
+
+    void CallBack();		// called when the time has come
+};
 
 class Kernel {
   public:
@@ -40,6 +56,13 @@ class Kernel {
     void ConsoleTest();         // interactive console self test
 
     void NetworkTest();         // interactive 2-machine network test
+
+    void SaveCheckpoint(char *fileName);
+				// save the state of the running user
+				// program in a UNIX file
+    void Resume(char *fileName);
+				// run the user program saved in a
+				// checkpoint, from where it was saved
     
 // These are public for notational convenience; really, 
 // they're global variables used everywhere.
@@ -54,14 +77,25 @@ class Kernel {
     SynchConsoleOutput *synchConsoleOut;
     SynchDisk *synchDisk;
     FileSystem *fileSystem;     
+    SwapSpace *swapSpace;	// where dirty pages go when evicted
+    PageoutDaemon *pageout;	// keeps some frames free
     PostOfficeInput *postOfficeIn;
     PostOfficeOutput *postOfficeOut;
 
     int hostName;               // machine identifier
 
   private:
+    void LoadProfile(char *fileName);
+				// set machine parameters from a file
+    bool SetParameter(const char *name, int value);
+				// set one machine parameter, if it exists
+
     bool randomSlice;		// enable pseudo-random time slicing
     bool debugUserProg;         // single step user program
+    ExecEngine engine;          // how to execute user instructions
+    ReplacementPolicy replacement;  // how to choose pages to evict
+    char *checkpointFile;       // file to save a checkpoint in, if any
+    int checkpointTime;         // when to save it
     double reliability;         // likelihood messages are dropped
     char *consoleIn;            // file to read console input from
     char *consoleOut;           // file to send console output to
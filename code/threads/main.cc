@@ -2,17 +2,34 @@
 //	Driver code to initialize, selftest, and run the 
 //	operating system kernel.  
 //
-// Usage: nachos -d <debugflags> -rs <random seed #>
-//              -s -x <nachos file> -ci <consoleIn> -co <consoleOut>
+// Usage: nachos -d <debugflags> -t <traceflags> -rs <random seed #>
+//              -s -E <engine> -V <policy> -x <nachos file>
+//              -ci <consoleIn> -co <consoleOut>
+//              -P <profile file> -M <parameter> <value>
+//              -S <checkpoint file> <time> -R <checkpoint file>
 //              -f -cp <unix file> <nachos file>
 //              -p <nachos file> -r <nachos file> -l -D
 //              -n <network reliability> -m <machine id>
 //              -z -K -C -N
 //
 //    -d causes certain debugging messages to be printed (see debug.h)
+//    -t causes events in the given categories to be recorded in the
+//       trace buffer, which is printed when the machine halts
 //    -rs causes Yield to occur at random (but repeatable) spots
 //    -z prints the copyright message
 //    -s causes user programs to be executed in single-step mode
+//    -E selects the engine executing user instructions: "threaded"
+//       (the default), "block" (translated basic blocks) or "switch"
+//       (the original interpreter)
+//    -V selects the page replacement policy: "lru" (the default),
+//       "clock", "2clock" (two-handed clock) or "wsclock"
+//    -P sets machine parameters (memory and page size, TLB size, size
+//       of each address space, disk geometry, tick costs) from a file;
+//       see Kernel::LoadProfile
+//    -M sets one machine parameter, e.g. "-M NumPhysPages 512"
+//    -S saves a checkpoint of the running user program once simulated
+//       time reaches <time>
+//    -R resumes the user program saved in a checkpoint, instead of -x
 //    -x runs a user program
 //    -ci specify file for console input (stdin is the default)
 //    -co specify file for console output (stdout is the default)
@@ -178,7 +195,9 @@ int
 main(int argc, char **argv) {
     int i;
     char *debugArg = "";
+    char *traceArg = NULL;
     char *userProgName = NULL;        // default is not to execute a user prog
+    char *resumeFileName = NULL;      // checkpoint to resume, if any
     bool threadTestFlag = false;
     bool consoleTestFlag = false;
     bool networkTestFlag = false;
@@ -199,12 +218,20 @@ main(int argc, char **argv) {
             ASSERT(i + 1 < argc);   // next argument is debug string
             debugArg = argv[i + 1];
             i++;
+        } else if (strcmp(argv[i], "-t") == 0) {
+            ASSERT(i + 1 < argc);   // next argument is trace string
+            traceArg = argv[i + 1];
+            i++;
         } else if (strcmp(argv[i], "-z") == 0) {
             cout << copyright << "\n";
         } else if (strcmp(argv[i], "-x") == 0) {
             ASSERT(i + 1 < argc);
             userProgName = argv[i + 1];
             i++;
+        } else if (strcmp(argv[i], "-R") == 0) {
+            ASSERT(i + 1 < argc);
+            resumeFileName = argv[i + 1];
+            i++;
         } else if (strcmp(argv[i], "-K") == 0) {
             threadTestFlag = TRUE;
         } else if (strcmp(argv[i], "-C") == 0) {
@@ -233,8 +260,8 @@ main(int argc, char **argv) {
         }
 #endif //FILESYS_STUB
         else if (strcmp(argv[i], "-u") == 0) {
-            cout << "Partial usage: nachos [-z -d debugFlags]\n";
-            cout << "Partial usage: nachos [-x programName]\n";
+            cout << "Partial usage: nachos [-z -d debugFlags -t traceFlags]\n";
+            cout << "Partial usage: nachos [-x programName] [-R checkpointFile]\n";
             cout << "Partial usage: nachos [-K] [-C] [-N]\n";
 #ifndef FILESYS_STUB
             cout << "Partial usage: nachos [-cp UnixFile NachosFile]\n";
@@ -244,7 +271,7 @@ main(int argc, char **argv) {
         }
 
     }
-    debug = new Debug(debugArg);
+    debug = new Debug(debugArg, traceArg);
 
     DEBUG(dbgThread, "Entering main");
 
@@ -290,19 +317,23 @@ main(int argc, char **argv) {
     }
 #endif // FILESYS_STUB
 
-    // finally, run an initial user program if requested to do so
+    // finally, run an initial user program if requested to do so,
+    // either from a checkpoint or from scratch
+    if (resumeFileName != NULL) {
+        kernel->Resume(resumeFileName);  // never returns
+    }
 
     //按ppt上的，申请两个地址空间，但只运行第二个
+    //第二个不再重新装入程序，而是第一个的写时复制副本
     if (userProgName != NULL) {
         AddrSpace *space1 = new AddrSpace;
         AddrSpace *space2 = new AddrSpace;
         ASSERT(space1 != (AddrSpace *) NULL);
         ASSERT(space2 != (AddrSpace *) NULL);
-        if (space1->Load(userProgName)) {  // load the program into the space
-            if (space2->Load(userProgName)) {
-                space2->Execute();              // run the program
-                ASSERTNOTREACHED();            // Execute never returns
-            }
+        if (space1->Load(userProgName)      // load the program into the space
+            && space2->Duplicate(space1)) {
+            space2->Execute();              // run the program
+            ASSERTNOTREACHED();            // Execute never returns
         }
     }
 
@@ -31,6 +31,8 @@ class Scheduler {
     void CheckToBeDestroyed();// Check if thread that had been
     				// running needs to be deleted
     void Print();		// Print contents of ready list
+    bool IsEmpty() { return readyList->IsEmpty(); }
+				// Is no thread ready to run?
     
     static int Compare(Thread *x,Thread *y);
     // SelfTest for scheduler is implemented in class Thread
@@ -20,6 +20,18 @@
 #include "addrspace.h"
 #include "machine.h"
 #include "noff.h"
+#include "swap.h"
+#include "pageout.h"
+#include "synch.h"
+
+int VirtualPages = 0;			// see addrspace.h; machine parameters
+int DemandPaging = 1;
+int ReadaheadPages = 8;
+int MmapPages = 64;
+int MinResidentPages = 4;
+int FaultIntervalLow = 1000;
+int FaultIntervalHigh = 10000;
+int ResumePrefetchPages = 16;
 
 //----------------------------------------------------------------------
 // SwapHeader
@@ -57,6 +69,69 @@ SwapHeader (NoffHeader *noffH)
 #endif
 }
 
+// The address space holding each address space ID, the next ID to take
+// away from its owner when they are all in use, and for each TLB set the
+// next way to replace when the set is full.
+
+static AddrSpace *asidOwner[NumASIDs];
+static int nextASIDVictim = 0;
+static int *nextTLBWay = NULL;
+
+// The text cache: for each program that has been run, the frame that
+// last held each of its code pages, so that other instances of the
+// program can map that frame instead of reading the page again.  An
+// entry is only good while the frame still holds the page (see
+// FindText).
+
+class SharedText {
+  public:
+    char *fileName;
+    int numPages;
+    int *frames;			// -1 for pages not yet read
+};
+
+static List<SharedText *> *textCache = NULL;
+
+// Every address space in existence, to find the ones holding more frames
+// than their allotment, and those suspended to relieve thrashing, in the
+// order they were suspended.
+
+static List<AddrSpace *> *allSpaces = NULL;
+static List<AddrSpace *> *suspendedSpaces = NULL;
+
+//----------------------------------------------------------------------
+// TextFramesFor
+// 	Return the text cache entry of program "fileName", whose code
+//	takes "numPages" whole pages, making one if this is its first run.
+//	Only those pages can be shared, so only they have an entry.
+//----------------------------------------------------------------------
+
+static int *
+TextFramesFor(char *fileName, int numPages)
+{
+    SharedText *text;
+
+    if (textCache == NULL) {
+	textCache = new List<SharedText *>;
+    }
+    for (ListIterator<SharedText *> it(textCache); !it.IsDone(); it.Next()) {
+	if (strcmp(it.Item()->fileName, fileName) == 0) {
+	    ASSERT(it.Item()->numPages >= numPages);
+	    return it.Item()->frames;
+	}
+    }
+    text = new SharedText;
+    text->fileName = new char[strlen(fileName) + 1];
+    strcpy(text->fileName, fileName);
+    text->numPages = numPages;
+    text->frames = new int[numPages];
+    for (int i = 0; i < numPages; i++) {
+	text->frames[i] = -1;
+    }
+    textCache->Append(text);
+    return text->frames;
+}
+
 //----------------------------------------------------------------------
 // AddrSpace::AddrSpace
 // 	Create an address space to run a user program.
@@ -70,6 +145,32 @@ AddrSpace::AddrSpace()
     cout << "creating a new addrSpace!" << endl;
     //申请暂存的寄存器buffer的空间
     s_reg = new int[NumTotalRegs];
+    asid = -1;				// assigned when we first run
+    pageTable = NULL;
+    programFile = NULL;
+    textFrames = NULL;
+    numTextPages = 0;
+    areas = new VMTable;
+    mmapStart = mmapEnd = 0;
+    allotment = MinResidentPages;
+    lastFaultTime = 0;
+    numFaults = 0;
+    active = FALSE;			// until we run
+    resume = new Semaphore("resume", 0);
+    workingSet = new int[ResumePrefetchPages];
+    workingSetSize = 0;
+    prefetchPending = FALSE;
+    if (allSpaces == NULL) {
+	allSpaces = new List<AddrSpace *>;
+	suspendedSpaces = new List<AddrSpace *>;
+    }
+    allSpaces->Append(this);
+    lastFault = -1;			// no faults yet
+    raStart = raEnd = 0;
+    raWindow = 1;
+    for (int i = 0; i < NumPerfCounters; i++) {
+	perfCounters[i] = 0;
+    }
     // zero out the entire address space
     //bzero(kernel->machine->mainMemory, MemorySize);
 }
@@ -81,16 +182,47 @@ AddrSpace::AddrSpace()
 
 AddrSpace::~AddrSpace()
 {
-   for (int i=0; i < NumPhysPages; i++){
-	if (pageTable[i].physicalPage != -1){
+   //先撤销文件映射，把其中的脏页写回文件
+   for (int i = 0; i < areas->NumAreas(); i++) {
+	if (areas->Get(i)->type == MappedArea) {
+	    UnmapArea(areas->Get(i));
+	}
+   }
+   //只访问已分配二级页表的部分，没有二级页表的部分从未映射过，整张表跳过
+   for (int i = pageTable->NextMapped(0); i < pageTable->Size();
+	i = pageTable->NextMapped(i + 1)){
+	TranslationEntry *pte = pageTable->Lookup(i);
+	if (pte != NULL && pte->physicalPage != -1
+	    && kernel->machine->GlobalPageTable[pte->physicalPage].refCount > 1){
+		//与其他地址空间共享的页（写时复制或共享代码）不释放，只从反向映射中去掉自己
+		kernel->machine->InvalidateFastTLB(pte->physicalPage);
+		kernel->machine->RemoveUser(pte->physicalPage, pageTable);
+	} else if (pte != NULL && pte->physicalPage != -1){
 		//只清除自己的地址空间中占用的物理内存页
-		bzero(&(kernel->machine->mainMemory[pageTable[i].physicalPage*PageSize]), PageSize);
-		//同时将全局页表的引用改为null，使得其可以作为freeframe被找到
-		kernel->machine->GlobalPageTable[pageTable[i].physicalPage].RefPageTable = NULL;
-		kernel->machine->GlobalPageTable[pageTable[i].physicalPage].VirNum = -1;
+		bzero(&(kernel->machine->mainMemory[pte->physicalPage*PageSize]), PageSize);
+		kernel->machine->InvalidateDecodedPage(pte->physicalPage);
+		kernel->machine->InvalidateFastTLB(pte->physicalPage);
+		//同时将全局页表的引用改为null，并放回空闲链表，使得其可以作为freeframe被找到
+		kernel->machine->FreeFrame(pte->physicalPage);
 	}
+	//换出过的页，释放其交换槽
+	if (pte != NULL && pte->swapSlot != NoSwapSlot){
+		kernel->swapSpace->Free(pte->swapSlot);
+	}
+   }
+   FlushTLB();
+   if (asid >= 0) {
+	asidOwner[asid] = NULL;
    }
+   //我们的物理页都已释放，被挂起的进程也许可以继续运行了
+   allSpaces->Remove(this);
+   active = FALSE;
+   ResumeSuspended();
+   delete resume;
+   delete [] workingSet;
    delete pageTable;
+   delete areas;
+   delete programFile;
 }
 
 
@@ -98,8 +230,12 @@ AddrSpace::~AddrSpace()
 // AddrSpace::Load
 // 	Load a user program into memory from a file.
 //
-//	Assumes that the page table has been initialized, and that
-//	the object code file is in NOFF format.
+//	With DemandPaging, nothing is read but the header: pages are
+//	brought in by the page fault handler when first touched.
+//	Otherwise every frame that is free is given to the program and
+//	filled now.
+//
+//	Assumes that the object code file is in NOFF format.
 //
 //	"fileName" is the file containing the object code to load into memory
 //----------------------------------------------------------------------
@@ -134,127 +270,999 @@ AddrSpace::Load(char *fileName)
 			+ UserStackSize;	// we need to increase the size
 						// to leave room for the stack
 #endif
-    numPages = divRoundUp(size, PageSize);
+    //程序、映射文件用的地址、栈各占整页，互不共享
+    numPages = divRoundUp(size - UserStackSize, PageSize) + MmapPages
+	       + divRoundUp(UserStackSize, PageSize);
+    //在数据段和栈之间留出映射文件用的地址
+    mmapStart = divRoundUp(size - UserStackSize, PageSize) * PageSize;
+    //虚拟地址空间可以比程序大（栈放在最高处），页表按需分配，不再受物理内存大小限制
+    if ((unsigned) VirtualPages > numPages)
+	numPages = VirtualPages;
     size = numPages * PageSize;
+    mmapEnd = size - divRoundUp(UserStackSize, PageSize) * PageSize;
 
-    ASSERT(numPages <= NumPhysPages);		// check we're not trying
-						// to run anything too big --
-						// at least until we have
-						// virtual memory
     cout << "loading program " << fileName << endl;
-    pageTable = new TranslationEntry[NumPhysPages];
+    DEBUG(dbgAddr, "Initializing address space: " << numPages << ", " << size);
+
+    //程序文件在地址空间存在期间一直打开，缺页时从中读入
+    programFile = executable;
+    //代码段、数据段、只读数据段从程序文件读入，bss和栈填零；其余地址不属于地址空间
+    AddSegment(CodeArea, noffH.code.virtualAddr, noffH.code.size,
+	       noffH.code.inFileAddr, FALSE);
+    AddSegment(DataArea, noffH.initData.virtualAddr, noffH.initData.size,
+	       noffH.initData.inFileAddr, TRUE);
+#ifdef RDATA
+    AddSegment(DataArea, noffH.readonlyData.virtualAddr, noffH.readonlyData.size,
+	       noffH.readonlyData.inFileAddr, FALSE);
+#endif
+    AddSegment(ZeroArea, noffH.uninitData.virtualAddr, noffH.uninitData.size,
+	       0, TRUE);
+    AddSegment(StackArea, mmapEnd, size - mmapEnd, 0, TRUE);
+    //同一程序的各个实例共享代码页
+    numTextPages = CountTextPages();
+    textFrames = TextFramesFor(fileName, numTextPages);
+
+    if (DemandPaging) {
+	//按需调页：装入时只记录段信息，页表为空，每一页在第一次访问时缺页调入
+	//（bss和栈的页由FillPage填零，不读文件）
+	pageTable = new PageTable(numPages);
+	pageTable->diskFile = fileName;
+	cout << "Successfully loading " << fileName << endl;
+	return TRUE;
+    }
+
+    pageTable = new PageTable(max(numPages, (unsigned) NumPhysPages));
+    //存储本程序加载的程序名称，用于在缺页中写回页面
+    pageTable->diskFile = fileName;
     //本来应该是 i < numPages，但是由于程序所用的page过少，如果按需分配将会导致无法测试缺页
     //因此这里改为 i < NumPhysPages， 即有多少个分配多少个，可以导致足够的缺页数量进行测试
     for (int i = 0; i < NumPhysPages; i++) {
-	pageTable[i].virtualPage = i;	// for now, virt page # = phys page #
-	pageTable[i].physicalPage = kernel->machine->findFreeFrame(i, pageTable);     //修改为寻找空闲的Frame
-	pageTable[i].valid = TRUE;
-	pageTable[i].use = FALSE;
-	pageTable[i].dirty = FALSE;
-	pageTable[i].readOnly = FALSE;  
-	//存储本程序加载的程序名称，用于在缺页中写回页面
-	pageTable[i].DiskFile = fileName;
-    }
+	int next = areas->FirstEndingAfter(i * PageSize);
+	TranslationEntry *pte;
 
-    DEBUG(dbgAddr, "Initializing address space: " << numPages << ", " << size);
-    cout << "Initializing address space: " << numPages << " , " << size << endl;
-
-    //存储本程序的元信息
-    FileAddr = new int[9];
-    FileAddr[0] = noffH.code.virtualAddr;
-    FileAddr[1] = noffH.code.size;
-    FileAddr[2] = noffH.code.inFileAddr;
-    FileAddr[3] = noffH.initData.virtualAddr;
-    FileAddr[4] = noffH.initData.size;
-    FileAddr[5] = noffH.initData.inFileAddr;
-    FileAddr[6] = noffH.readonlyData.virtualAddr;
-    FileAddr[7] = noffH.readonlyData.size;
-    FileAddr[8] = noffH.readonlyData.inFileAddr;
-
-    cout << "**************** Page Table ****************" << endl;
-    //kernel->machine->printPt();
-    for (int i=0; i < PageSize; i++){
-	cout << "virtual page "<< pageTable[i].virtualPage << " physical page: " << pageTable[i].physicalPage << endl;
-    }
-
-// then, copy in the code and data segments into memory
-// Note: this code assumes that virtual address = physical address
-    int add, vaddr;
-    if (noffH.code.size > 0) {
-        DEBUG(dbgAddr, "Initializing code segment.");
-	DEBUG(dbgAddr, noffH.code.virtualAddr << ", " << noffH.code.size);
-	//逐字节读入代码，但是需要把虚拟地址通过页表转化为物理地址，以下同
-	//转换公式：virtualAddr/PageSize得到虚拟页号，利用该虚拟页号查页表得到物理页号
-	//再利用物理页号*PageSize得到对应物理页起始地址，再加上virtualAddr%PageSize得到页内偏移得到物理地址
-	for (int i=0; i < noffH.code.size; i++){
-		vaddr = noffH.code.virtualAddr+i;
-		add = pageTable[vaddr/PageSize].physicalPage*PageSize + vaddr%PageSize;
-		//只有分配到物理页的数据才会读入
-		if (pageTable[vaddr/PageSize].physicalPage >= 0){
-			executable->ReadAt(&(kernel->machine->mainMemory[add]), 1, noffH.code.inFileAddr+i);		
-		}
-	}
-	/*
-	if (pageTable[noffH.code.virtualAddr/PageSize].physicalPage >= 0){
-		add = pageTable[noffH.code.virtualAddr/PageSize].physicalPage*PageSize + noffH.code.virtualAddr%PageSize;
-		cout << "code:           vir add: " << noffH.code.virtualAddr << " phy add: " << add << endl;
-		executable->ReadAt(
-			&(kernel->machine->mainMemory[add]), 
-				noffH.code.size, noffH.code.inFileAddr);
-	}
-	executable->ReadAt(&(kernel->machine->mainMemory[noffH.code.virtualAddr]),
-				noffH.code.size, noffH.code.inFileAddr);*/
-    }
-    if (noffH.initData.size > 0) {
-        DEBUG(dbgAddr, "Initializing data segment.");
-	DEBUG(dbgAddr, noffH.initData.virtualAddr << ", " << noffH.initData.size);
-	for (int i=0; i < noffH.initData.size; i++){
-		vaddr = noffH.initData.virtualAddr+i;
-		add = pageTable[vaddr/PageSize].physicalPage*PageSize + vaddr%PageSize;
-		if (pageTable[vaddr/PageSize].physicalPage >= 0){
-			executable->ReadAt(&(kernel->machine->mainMemory[add]), 1, noffH.initData.inFileAddr+i);		
-		}
-	}/*
-	if (pageTable[noffH.initData.virtualAddr/PageSize].physicalPage >= 0){
-		add = pageTable[noffH.initData.virtualAddr/PageSize].physicalPage*PageSize + noffH.initData.virtualAddr%PageSize;
-		cout << "data:           vir add: " << noffH.initData.virtualAddr << " phy add: " << add << endl;
-		executable->ReadAt(
-			&(kernel->machine->mainMemory[add]),
-				noffH.initData.size, noffH.initData.inFileAddr);
-	}
-
-	executable->ReadAt(&(kernel->machine->mainMemory[noffH.initData.virtualAddr]),
-			noffH.initData.size, noffH.initData.inFileAddr);*/
+	//只映射有区域覆盖的页：映射文件用的地址等空隙留给缺页处理（Mmap之后从文件读入）
+	if (next == areas->NumAreas()
+	    || areas->Get(next)->start >= (i + 1) * PageSize) {
+	    continue;
+	}
+	pte = pageTable->Entry(i);
+	pte->physicalPage = kernel->machine->findFreeFrame(i, pageTable);     //修改为寻找空闲的Frame
+	pte->valid = TRUE;
+	DEBUG(dbgAddr, "virtual page " << i << " physical page: " << pte->physicalPage);
     }
 
-#ifdef RDATA
-    if (noffH.readonlyData.size > 0) {
-        DEBUG(dbgAddr, "Initializing read only data segment.");
-	DEBUG(dbgAddr, noffH.readonlyData.virtualAddr << ", " << noffH.readonlyData.size);
-	for (int i=0; i < noffH.readonlyData.size; i++){
-		vaddr = noffH.readonlyData.virtualAddr+i;
-		add = pageTable[vaddr/PageSize].physicalPage*PageSize + vaddr%PageSize;
-		if (pageTable[vaddr/PageSize].physicalPage >= 0){
-			executable->ReadAt(&(kernel->machine->mainMemory[add]), 1, noffH.readonlyData.inFileAddr+i);		
-		}
-	}
-	/*
-	if (pageTable[noffH.readonlyData.virtualAddr/PageSize].physicalPage >= 0){
-		add = pageTable[noffH.readonlyData.virtualAddr/PageSize].physicalPage*PageSize + noffH.readonlyData.virtualAddr%PageSize;
-		executable->ReadAt(
-			&(kernel->machine->mainMemory[add]),
-				noffH.readonlyData.size, noffH.readonlyData.inFileAddr);
-	}
-	executable->ReadAt(&(kernel->machine->mainMemory[noffH.readonlyData.virtualAddr]),
-				noffH.readonlyData.size, noffH.readonlyData.inFileAddr);*/
+// then, copy in the code and data segments into memory, a page at a time
+    //只有分配到物理页的页才会读入，其余的页在缺页时同样由FillPage读入
+    for (int i = 0; i < NumPhysPages; i++) {
+	TranslationEntry *pte = pageTable->Lookup(i);
+	if (pte != NULL && pte->valid && pte->physicalPage >= 0) {
+	    FillPage(i, pte->physicalPage);
+	    //代码页和只读数据页只读，代码页并提供给同一程序的其他实例
+	    pte->readOnly = !IsWritable(i);
+	    if (IsText(i)) {
+		AddText(i, pte->physicalPage);
+	    }
+	}
     }
-#endif
 
-    delete executable;			// close file
     cout << "Successfully loading " << fileName << endl;
     return TRUE;			// success
 }
 
+//----------------------------------------------------------------------
+// AddrSpace::Duplicate
+// 	Make this (new, empty) address space a copy-on-write copy of
+//	"parent", as fork does: the same program and registers, and every
+//	page the parent has in memory shared with it, read-only, in both.
+//	The first write to a shared page by either one copies it (see
+//	CopyOnWrite).  Pages the parent has in swap are copied to new
+//	slots; the rest are faulted in from the program file as usual.
+//
+//	Copying a slot waits for the swap device, and meanwhile the
+//	pageout daemon may evict the parent's pages.  Their contents can't
+//	change (the parent doesn't run while it is copied), only where
+//	they are, so each page's entry is copied only after the last wait
+//	for that page.  A shared page never shares the parent's slot: if
+//	it has one, our copy is marked dirty, so that evicting it gives
+//	us a slot of our own.
+//
+//	If swap is too full to copy a page, it is read into a free frame
+//	of ours instead, to get a slot when it is evicted.  Return FALSE
+//	if there is no free frame either.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::Duplicate(AddrSpace *parent)
+{
+    //父进程正在运行时，TLB和快速翻译缓存中可能有可写的映射，先清掉
+    //（同时把TLB中的脏位写回父进程的页表）
+    parent->FlushTLB();
+    kernel->machine->FlushFastTLB();
+
+    numPages = parent->numPages;
+    pageTable = new PageTable(parent->pageTable->Size());
+    pageTable->diskFile = parent->pageTable->diskFile;
+    programFile = kernel->fileSystem->Open(pageTable->diskFile);
+    ASSERT(programFile != NULL);
+    textFrames = parent->textFrames;
+    numTextPages = parent->numTextPages;
+    //映射的文件各自重新打开
+    mmapStart = parent->mmapStart;
+    mmapEnd = parent->mmapEnd;
+    for (int i = 0; i < parent->areas->NumAreas(); i++) {
+	VMArea *from = parent->areas->Get(i);
+	VMArea *to = new VMArea(from->type, from->start, from->end, from->writable);
+
+	if (from->type == MappedArea) {
+	    OpenFile *file = kernel->fileSystem->Open(from->mappedName);
+
+	    ASSERT(file != NULL);
+	    to->SetBacking(file, from->offset, from->fileSize, from->mappedName);
+	} else if (from->file != NULL) {
+	    to->SetBacking(programFile, from->offset, from->fileSize, NULL);
+	}
+	areas->Insert(to);
+    }
+
+    for (int i = 0; i < NumTotalRegs; i++) {
+	s_reg[i] = (kernel->currentThread->space == parent)
+		   ? kernel->machine->ReadRegister(i) : parent->s_reg[i];
+    }
+
+    for (int i = 0; i < pageTable->Size(); i++) {
+	TranslationEntry *from = parent->pageTable->Lookup(i);
+	TranslationEntry *to;
+
+	if (from == NULL) {
+	    continue;
+	}
+	to = pageTable->Entry(i);
+	if (from->valid && from->physicalPage != -1) {
+	    //共享该物理页；本来可写的页双方都改为只读，第一次写时再复制
+	    *to = *from;
+	    if (!from->readOnly) {
+		from->readOnly = to->readOnly = TRUE;
+		from->cow = to->cow = TRUE;
+	    }
+	    //不与父进程共用交换槽：该页换出时为我们另分配一个
+	    if (from->swapSlot != NoSwapSlot) {
+		to->swapSlot = NoSwapSlot;
+		to->dirty = TRUE;
+	    }
+	    kernel->machine->AddUser(from->physicalPage, pageTable);
+	} else if (from->swapSlot != NoSwapSlot) {
+	    //只在交换区中的页复制到新的槽；复制时会等待设备，页表项等复制完成后再设置
+	    int slot = kernel->swapSpace->Copy(from->swapSlot);
+	    int frame;
+
+	    if (slot != NoSwapSlot) {
+		*to = *from;
+		to->valid = FALSE;
+		to->physicalPage = -1;
+		to->swapSlot = slot;
+		continue;
+	    }
+	    //交换区已满：读入一个空闲的物理页，作为我们私有的脏页
+	    frame = kernel->machine->findFreeFrame(i, pageTable);
+	    if (frame == -1) {
+		cerr << "Out of memory: can't copy page " << i << " of the parent\n";
+		return FALSE;
+	    }
+	    kernel->machine->GlobalPageTable[frame].busy = TRUE;
+	    kernel->swapSpace->ReadPage(from->swapSlot,
+					&(kernel->machine->mainMemory[frame * PageSize]));
+	    *to = *from;
+	    to->valid = TRUE;
+	    to->physicalPage = frame;
+	    to->swapSlot = NoSwapSlot;
+	    to->use = FALSE;
+	    to->dirty = TRUE;
+	    to->cow = FALSE;
+	    to->readOnly = !IsWritable(i);
+	    kernel->machine->GlobalPageTable[frame].busy = FALSE;
+	} else {
+	    *to = *from;
+	}
+    }
+    TRACE(dbgVm, TraceEvents, "duplicated address space of %d pages", numPages);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CopyOnWrite
+// 	Virtual page "vpn" is shared copy-on-write, and we just tried to
+//	write it.  If others still use the frame, give us a private copy
+//	in "frame" (a frame GetFrame just found us); otherwise the frame
+//	is ours alone, and "frame" is -1.  Either way the page becomes
+//	writable.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::CopyOnWrite(int vpn, int frame)
+{
+    TranslationEntry *pte = pageTable->Lookup(vpn);
+    int shared = pte->physicalPage;
+    GlobalEntry *global = &kernel->machine->GlobalPageTable[shared];
+
+    ASSERT(pte->cow);
+    if (frame != -1) {
+	bcopy(&(kernel->machine->mainMemory[shared * PageSize]),
+	      &(kernel->machine->mainMemory[frame * PageSize]), PageSize);
+	kernel->machine->RemoveUser(shared, pageTable);
+	pte->physicalPage = frame;
+	kernel->stats->numCOWCopies++;
+	TRACE(dbgVm, TraceEvents, "copy on write: vpn %d from frame %d to %d",
+	      vpn, shared, frame);
+    } else {
+	//只剩我们在用这一页，直接接管
+	ASSERT(global->refCount == 1);
+	global->RefPageTable = pageTable;
+	global->VirNum = vpn;
+    }
+    pte->readOnly = FALSE;
+    pte->cow = FALSE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::IsText
+// 	Return TRUE if virtual page "vpn" lies wholly within the code
+//	segment, the one read-only segment of the program.  Such pages
+//	are never written, so every instance of the program can map the
+//	same frame, read-only.  A page the code shares with data is kept
+//	private.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::IsText(int vpn)
+{
+    int start = vpn * PageSize;
+    VMArea *area = areas->Find(start);
+
+    return area != NULL && area->type == CodeArea && start + PageSize <= area->end;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::CountTextPages
+// 	Return how many pages, from page 0, lie wholly within the code
+//	segment: the size of our program's entry in the text cache.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::CountTextPages()
+{
+    for (int i = 0; i < areas->NumAreas(); i++) {
+	if (areas->Get(i)->type == CodeArea) {
+	    return areas->Get(i)->end / PageSize;
+	}
+    }
+    return 0;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::IsWritable
+// 	Return FALSE if no area in virtual page "vpn" is writable -- it
+//	holds only code, read-only data, or a file mapped read-only; such
+//	pages are mapped read-only.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::IsWritable(int vpn)
+{
+    int start = vpn * PageSize;
+    int i = areas->FirstEndingAfter(start);
+
+    if (i == areas->NumAreas() || areas->Get(i)->start >= start + PageSize) {
+	return TRUE;			// in no area
+    }
+    for (; i < areas->NumAreas() && areas->Get(i)->start < start + PageSize; i++) {
+	if (areas->Get(i)->writable) {
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FaultArea
+// 	Return the area holding "addr", where a page fault has happened,
+//	or NULL if the address isn't part of the address space.  Found
+//	with one lookup in the table.
+//
+//	An address in no area, but below the stack and not below the
+//	stack pointer, is the stack growing: the stack area is extended
+//	down to its page.  At least a page is kept free between the stack
+//	and the area under it, so that a runaway stack faults rather than
+//	running into it.
+//----------------------------------------------------------------------
+
+VMArea *
+AddrSpace::FaultArea(int addr)
+{
+    int i = areas->FirstEndingAfter(addr);
+    VMArea *area;
+    int start, floor;
+
+    if (i == areas->NumAreas()) {
+	return NULL;
+    }
+    area = areas->Get(i);
+    if (area->start <= addr) {
+	return area;
+    }
+    if (area->type != StackArea
+	|| addr < (int) kernel->machine->ReadRegister(StackReg)) {
+	return NULL;
+    }
+    start = divRoundDown(addr, PageSize) * PageSize;
+    floor = (i == 0) ? 0 : divRoundUp(areas->Get(i - 1)->end, PageSize) * PageSize + PageSize;
+    if (start < floor) {
+	return NULL;
+    }
+    kernel->stats->numStackGrowths += (area->start - start) / PageSize;
+    TRACE(dbgVm, TraceEvents, "stack grown from %d down to %d", area->start, start);
+    area->start = start;
+    return area;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::AddSegment
+// 	Add an area of "size" bytes at "start" to the layout of the
+//	program.  Code and data areas come from the program file, at
+//	"inFileAddr"; the others are zero-filled.  Empty segments get no
+//	area.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::AddSegment(VMAreaType type, int start, int size, int inFileAddr,
+		      bool writable)
+{
+    VMArea *area;
+
+    if (size <= 0) {
+	return;
+    }
+    area = new VMArea(type, start, start + size, writable);
+    if (type == CodeArea || type == DataArea) {
+	area->SetBacking(programFile, inFileAddr, size, NULL);
+    }
+    areas->Insert(area);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FindText
+// 	Return the frame in which another instance of our program has
+//	code page "vpn", or -1 if none has it in memory.  The text cache
+//	remembers the last frame that held each page; it is only believed
+//	if the frame is still a shared code page of this program at "vpn".
+//----------------------------------------------------------------------
+
+int
+AddrSpace::FindText(int vpn)
+{
+    GlobalEntry *global;
+    int frame;
+
+    if (textFrames == NULL || vpn < 0 || vpn >= numTextPages || !IsText(vpn)
+	|| textFrames[vpn] == -1) {
+	return -1;
+    }
+    frame = textFrames[vpn];
+    global = &kernel->machine->GlobalPageTable[frame];
+    if (!global->sharedText || global->VirNum != vpn || global->RefPageTable == NULL
+	|| strcmp(global->RefPageTable->diskFile, pageTable->diskFile) != 0) {
+	return -1;
+    }
+    return frame;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::AddText
+// 	Code page "vpn" has just been read into "frame": record it in
+//	the text cache, so that other instances map it rather than read
+//	it again.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::AddText(int vpn, int frame)
+{
+    ASSERT(vpn >= 0 && vpn < numTextPages && IsText(vpn));
+    textFrames[vpn] = frame;
+    kernel->machine->GlobalPageTable[frame].sharedText = TRUE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Mmap
+// 	Map "length" bytes of file "fileName", from "offset" on, into the
+//	addresses kept for mapped files (the lowest free range of whole
+//	pages), and return the address of the first byte, or -1 if the
+//	file can't be opened or there is no room.  Nothing is read now:
+//	each page is read from the file the first time it is touched,
+//	like the program's own pages, and if "writable", dirty pages are
+//	written back to the file when evicted or unmapped.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::Mmap(char *fileName, int offset, int length, bool writable)
+{
+    int size, addr;
+    OpenFile *file;
+    VMArea *area;
+
+    if (length <= 0 || offset < 0) {
+	return -1;
+    }
+    //映射占整页：最后一页中文件之后的部分填零
+    size = divRoundUp(length, PageSize) * PageSize;
+    addr = areas->FindGap(size, mmapStart, mmapEnd);
+    if (addr == -1) {
+	return -1;
+    }
+    file = kernel->fileSystem->Open(fileName);
+    if (file == NULL) {
+	return -1;
+    }
+    area = new VMArea(MappedArea, addr, addr + size, writable);
+    area->SetBacking(file, offset, length, fileName);
+    areas->Insert(area);
+    TRACE(dbgVm, TraceEvents, "mapped %d bytes from offset %d at %d",
+	  length, offset, addr);
+    return addr;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Munmap
+// 	Remove the mapped file at address "addr" (as returned by Mmap),
+//	writing its dirty pages back to the file.  Return 0, or -1 if no
+//	file is mapped there.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::Munmap(int addr)
+{
+    VMArea *area = areas->Find(addr);
+
+    if (area == NULL || area->type != MappedArea || area->start != addr) {
+	return -1;
+    }
+    UnmapArea(area);
+    areas->Remove(area);
+    delete area;
+    TRACE(dbgVm, TraceEvents, "unmapped file at %d", addr);
+    return 0;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::UnmapArea
+// 	Drop every page of mapped "area" from our page table, writing the
+//	dirty ones back to the file first, and free their frames.  A page
+//	still shared copy-on-write with another address space is left to
+//	it.  Pages being evicted are already unmapped, and written back
+//	by the eviction.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::UnmapArea(VMArea *area)
+{
+    int first = area->start / PageSize;
+    int last = divRoundUp(area->end, PageSize);
+
+    for (int vpn = first; vpn < last; vpn++) {
+	TranslationEntry *pte = pageTable->Lookup(vpn);
+	int frame;
+
+	if (pte == NULL || !pte->valid || pte->physicalPage == -1) {
+	    continue;
+	}
+	frame = pte->physicalPage;
+	//先从TLB中取回脏位，并丢弃指向该物理页的各种翻译
+	InvalidateTLB(frame);
+	kernel->machine->InvalidateFastTLB(frame);
+	if (kernel->machine->GlobalPageTable[frame].refCount > 1) {
+	    kernel->machine->RemoveUser(frame, pageTable);
+	} else {
+	    if (pte->dirty) {
+		WriteArea(area, vpn, frame);
+	    }
+	    kernel->machine->InvalidateDecodedPage(frame);
+	    kernel->machine->FreeFrame(frame);
+	}
+	pte->valid = FALSE;
+	pte->physicalPage = -1;
+	pte->dirty = FALSE;
+	pte->readOnly = FALSE;
+	pte->cow = FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::WriteArea
+// 	Write page "vpn" of mapped "area", held in "frame", back to the
+//	file.  Only the part of the page the mapping covers is written.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::WriteArea(VMArea *area, int vpn, int frame)
+{
+    int from = vpn * PageSize;
+    int to = min(from + PageSize, area->start + area->fileSize);
+
+    ASSERT(area->type == MappedArea && from >= area->start);
+    if (from < to) {
+	area->file->WriteAt(&(kernel->machine->mainMemory[frame * PageSize]),
+			    to - from, area->offset + (from - area->start));
+    }
+    kernel->stats->numMappedWrites++;
+    TRACE(dbgVm, TraceEvents, "wrote mapped vpn %d back from frame %d", vpn, frame);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::WriteBack
+// 	Called when dirty page "vpn" of page table "table", held in
+//	"frame", is evicted or pre-cleaned.  If the page belongs to a
+//	mapped file, write it back to the file and return TRUE; else
+//	return FALSE, and the caller writes it to swap.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::WriteBack(PageTable *table, int vpn, int frame)
+{
+    for (ListIterator<AddrSpace *> it(allSpaces); !it.IsDone(); it.Next()) {
+	AddrSpace *space = it.Item();
+	VMArea *area;
+
+	if (space->pageTable != table) {
+	    continue;
+	}
+	area = space->areas->Find(vpn * PageSize);
+	if (area == NULL || area->type != MappedArea) {
+	    return FALSE;
+	}
+	space->WriteArea(area, vpn, frame);
+	return TRUE;
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::IsMapped
+// 	Return TRUE if page "vpn" of page table "table" belongs to a
+//	mapped file, so that WriteBack would write it to the file.  The
+//	caller can then decide where the page goes before anything
+//	waits.
+//----------------------------------------------------------------------
+
+bool
+AddrSpace::IsMapped(PageTable *table, int vpn)
+{
+    for (ListIterator<AddrSpace *> it(allSpaces); !it.IsDone(); it.Next()) {
+	if (it.Item()->pageTable == table) {
+	    VMArea *area = it.Item()->areas->Find(vpn * PageSize);
+
+	    return area != NULL && area->type == MappedArea;
+	}
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FillPages
+// 	Fill physical pages "frames" with the initial contents of the
+//	"count" virtual pages starting at "vpn": the parts of the areas
+//	backed by files (program segments and mapped files) that fall in
+//	those pages, read with one read per area, and zeroes elsewhere
+//	(uninitialized data and stack).  Only the areas in the range are
+//	looked at.  Used when
+//	loading the program, when a page that was never swapped out
+//	faults in, and for readahead.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::FillPages(int vpn, int count, int *frames)
+{
+    char *buffer;
+    int start = vpn * PageSize;
+    int end = start + count * PageSize;
+
+    //只有一页时直接读入该物理页，多页时先读入缓冲区再分到各物理页
+    if (count == 1) {
+	buffer = &(kernel->machine->mainMemory[frames[0] * PageSize]);
+    } else {
+	buffer = new char[count * PageSize];
+    }
+    bzero(buffer, count * PageSize);
+    for (int i = areas->FirstEndingAfter(start);
+	 i < areas->NumAreas() && areas->Get(i)->start < end; i++) {
+	VMArea *area = areas->Get(i);
+	int from = max(start, area->start);
+	int to = min(end, area->start + area->fileSize);
+
+	if (area->file != NULL && from < to) {
+	    area->file->ReadAt(buffer + (from - start), to - from,
+			       area->offset + (from - area->start));
+	}
+    }
+    if (count > 1) {
+	for (int i = 0; i < count; i++) {
+	    bcopy(buffer + i * PageSize,
+		  &(kernel->machine->mainMemory[frames[i] * PageSize]), PageSize);
+	}
+	delete [] buffer;
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Readahead
+// 	Called after virtual page "vpn" has been faulted in.  If the
+//	faults are sequential -- this one follows the last, or comes just
+//	after the pages last read ahead -- bring in the pages following
+//	"vpn" with one batched read, doubling the number each time up to
+//	ReadaheadPages; any other fault shrinks the window back to one
+//	page.  Only free frames are used, leaving the FreeLowWater the
+//	pageout daemon keeps for page faults, and readahead stops at a
+//	page that is already in memory or in swap, or that doesn't start
+//	in an area (other than the stack).  The frames are busy while
+//	they are read, so that the pageout daemon doesn't take them.
+//
+//	The pages of the previous window are counted as prefetch hits if
+//	they were used (all of them, if the program has walked past them)
+//	and as misses otherwise.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Readahead(int vpn)
+{
+    bool sequential = (vpn == lastFault + 1 || (raEnd > raStart && vpn == raEnd));
+    int *frames;
+    int count;
+
+    for (int v = raStart; v < raEnd; v++) {
+	TranslationEntry *pte = pageTable->Lookup(v);
+
+	if (vpn == raEnd || (pte->valid && pte->physicalPage != -1
+			     && (pte->use || pte->dirty))) {
+	    kernel->stats->numPrefetchHits++;
+	} else {
+	    kernel->stats->numPrefetchMisses++;
+	}
+    }
+    raStart = raEnd = 0;
+    lastFault = vpn;
+    if (!sequential || ReadaheadPages == 0) {
+	raWindow = 1;
+	return;
+    }
+
+    frames = new int[raWindow];
+    for (count = 0; count < raWindow && vpn + 1 + count < (int) numPages; count++) {
+	int v = vpn + 1 + count;
+	TranslationEntry *pte = pageTable->Entry(v);
+	VMArea *area = areas->Find(v * PageSize);
+
+	if ((pte->valid && pte->physicalPage != -1) || pte->swapSlot != NoSwapSlot
+	    || FindText(v) != -1) {
+	    break;
+	}
+	//只预读在区域中的页，不越过区域之间的空隙，也不进入栈
+	if (area == NULL || area->type == StackArea) {
+	    break;
+	}
+	//不动用换页守护线程为缺页保留的空闲页
+	if (kernel->machine->NumFreeFrames() <= FreeLowWater) {
+	    break;
+	}
+	frames[count] = kernel->machine->findFreeFrame(v, pageTable);
+	if (frames[count] == -1) {
+	    break;
+	}
+	//读入期间不能被换出
+	kernel->machine->GlobalPageTable[frames[count]].busy = TRUE;
+    }
+    if (count > 0) {
+	FillPages(vpn + 1, count, frames);
+	for (int i = 0; i < count; i++) {
+	    TranslationEntry *pte = pageTable->Lookup(vpn + 1 + i);
+
+	    pte->physicalPage = frames[i];
+	    pte->valid = TRUE;
+	    pte->use = FALSE;
+	    pte->dirty = FALSE;
+	    pte->readOnly = !IsWritable(vpn + 1 + i);
+	    if (IsText(vpn + 1 + i)) {
+		AddText(vpn + 1 + i, frames[i]);
+	    }
+	    kernel->machine->GlobalPageTable[frames[i]].busy = FALSE;
+	}
+	raStart = vpn + 1;
+	raEnd = vpn + 1 + count;
+	kernel->stats->numPrefetched += count;
+	TRACE(dbgVm, TraceEvents, "read ahead %d pages after vpn %d", count, vpn);
+    }
+    delete [] frames;
+    raWindow = min(raWindow * 2, ReadaheadPages);
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::NoteFault
+// 	Called at each of our page faults, to size our resident set by
+//	the page fault frequency.  The time since the last fault is
+//	measured in our own instructions.  A fault within
+//	FaultIntervalLow of the last one means we need more memory: our
+//	allotment grows by a frame.  A long time without one means we
+//	have more than we need: the allotment shrinks by a frame for
+//	every FaultIntervalHigh instructions, down to MinResidentPages.
+//	A process with more frames than its allotment loses them first
+//	when frames are needed (see ChooseVictim).
+//
+//	If the allotments of the running processes add up to more than
+//	memory holds, they would thrash: we are suspended until there is
+//	room, unless we are the only one running.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::NoteFault()
+{
+    int now = ReadCounter(PerfInstructions);
+    int interval = now - lastFaultTime;
+    int demand = 0;
+    bool alone = TRUE;
+
+    numFaults++;
+    lastFaultTime = now;
+    if (interval < FaultIntervalLow) {
+	allotment = min(allotment + 1, NumPhysPages);
+    } else if (interval > FaultIntervalHigh) {
+	allotment = max(allotment - interval / FaultIntervalHigh, MinResidentPages);
+	ResumeSuspended();		// there may be room now
+    }
+
+    for (ListIterator<AddrSpace *> it(allSpaces); !it.IsDone(); it.Next()) {
+	if (it.Item()->active) {
+	    demand += it.Item()->allotment;
+	    alone = alone && (it.Item() == this);
+	}
+    }
+    if (demand > NumPhysPages && !alone) {
+	Suspend();
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Suspend
+// 	Swap the whole process out: evict every page we hold alone (shared
+//	pages stay with their other users), and sleep until
+//	ResumeSuspended finds room for our allotment.  Called from our
+//	page fault handler, which carries on when we are resumed, after
+//	reading back the pages we were using when suspended.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Suspend()
+{
+    int evicted = 0;
+
+    RecordWorkingSet();
+    active = FALSE;
+    suspendedSpaces->Append(this);
+    kernel->stats->numSuspensions++;
+    for (int i = pageTable->NextMapped(0); i < pageTable->Size();
+	 i = pageTable->NextMapped(i + 1)) {
+	TranslationEntry *pte = pageTable->Lookup(i);
+	int frame = pte->physicalPage;
+
+	if (!pte->valid || frame == -1
+	    || kernel->machine->GlobalPageTable[frame].refCount != 1
+	    || kernel->machine->GlobalPageTable[frame].busy
+	    || !PageoutDaemon::CanEvict(frame)) {
+	    continue;			// shared, in transfer, or no swap
+	}
+	PageoutDaemon::Evict(frame);
+	kernel->machine->GlobalPageTable[frame].busy = FALSE;
+	kernel->machine->FreeFrame(frame);
+	evicted++;
+    }
+    TRACE(dbgVm, TraceEvents, "suspended with allotment %d, %d pages swapped out",
+	  allotment, evicted);
+    ResumeSuspended();			// some earlier one may fit now
+    resume->P();
+    TRACE(dbgVm, TraceEvents, "resumed with allotment %d", allotment);
+    prefetchPending = TRUE;
+    PrefetchWorkingSet();
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::RecordWorkingSet
+// 	Note down our working set: the (up to) ResumePrefetchPages pages
+//	we hold that were used most recently, by the machine's LRU list.
+//	Shared pages are left out; they stay in memory with their other
+//	users.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::RecordWorkingSet()
+{
+    //先取得物理页号，再就地换成虚拟页号
+    workingSetSize = kernel->machine->NewestFrames(pageTable, workingSet,
+						   ResumePrefetchPages);
+    for (int i = 0; i < workingSetSize; i++) {
+	workingSet[i] = kernel->machine->GlobalPageTable[workingSet[i]].VirNum;
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::PrefetchWorkingSet
+// 	Called at our first page fault after we are switched back in, and
+//	when we are resumed after a suspension: read back the pages of our
+//	working set that were evicted while we weren't running, so that
+//	we don't fault them in again one by one.  Those in swap are read
+//	together, waiting once for all of them.
+//
+//	As with readahead, only free frames are used, leaving the
+//	FreeLowWater the pageout daemon keeps for page faults.  The frames
+//	are busy until the reads finish, so no one takes them meanwhile.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::PrefetchWorkingSet()
+{
+    int *vpns, *frames, *slots;
+    char **into;
+    int count = 0, batch = 0;
+
+    if (!prefetchPending) {
+	return;
+    }
+    prefetchPending = FALSE;
+    vpns = new int[workingSetSize];
+    frames = new int[workingSetSize];
+    slots = new int[workingSetSize];
+    into = new char *[workingSetSize];
+    for (int i = 0; i < workingSetSize; i++) {
+	int vpn = workingSet[i];
+	TranslationEntry *pte = pageTable->Lookup(vpn);
+	int frame;
+
+	//已在内存中的页（或可与其他实例共享的代码页）不必读回
+	if (pte == NULL || (pte->valid && pte->physicalPage != -1)
+	    || FindText(vpn) != -1) {
+	    continue;
+	}
+	//不动用换页守护线程为缺页保留的空闲页
+	if (kernel->machine->NumFreeFrames() <= FreeLowWater) {
+	    break;
+	}
+	frame = kernel->machine->findFreeFrame(vpn, pageTable);
+	if (frame == -1) {
+	    break;
+	}
+	kernel->machine->GlobalPageTable[frame].busy = TRUE;
+	//在交换区中的页一起读回，其余的页（干净的程序页或零页）直接填充
+	if (pte->swapSlot != NoSwapSlot) {
+	    slots[batch] = pte->swapSlot;
+	    into[batch] = &(kernel->machine->mainMemory[frame * PageSize]);
+	    batch++;
+	} else {
+	    FillPage(vpn, frame);
+	}
+	vpns[count] = vpn;
+	frames[count] = frame;
+	count++;
+    }
+    kernel->swapSpace->ReadPages(batch, slots, into);
+
+    for (int i = 0; i < count; i++) {
+	TranslationEntry *pte = pageTable->Lookup(vpns[i]);
+
+	pte->physicalPage = frames[i];
+	pte->valid = TRUE;
+	pte->use = FALSE;
+	pte->dirty = FALSE;
+	pte->readOnly = !IsWritable(vpns[i]);
+	if (IsText(vpns[i])) {
+	    AddText(vpns[i], frames[i]);
+	}
+	kernel->machine->GlobalPageTable[frames[i]].busy = FALSE;
+    }
+    if (count > 0) {
+	kernel->stats->numResumePrefetched += count;
+	TRACE(dbgVm, TraceEvents, "prefetched %d pages of the working set, %d from swap",
+	      count, batch);
+    }
+    delete [] vpns;
+    delete [] frames;
+    delete [] slots;
+    delete [] into;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::ResumeSuspended
+// 	Resume suspended processes, in the order they were suspended, for
+//	as long as their allotments fit in memory beside those of the
+//	running processes.  If none is running, the first is resumed in
+//	any case.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::ResumeSuspended()
+{
+    while (suspendedSpaces != NULL && !suspendedSpaces->IsEmpty()) {
+	AddrSpace *space = suspendedSpaces->Front();
+	int demand = 0;
+
+	for (ListIterator<AddrSpace *> it(allSpaces); !it.IsDone(); it.Next()) {
+	    if (it.Item()->active) {
+		demand += it.Item()->allotment;
+	    }
+	}
+	if (demand > 0 && demand + space->allotment > NumPhysPages) {
+	    break;
+	}
+	suspendedSpaces->RemoveFront();
+	space->active = TRUE;
+	space->resume->V();
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::ChooseVictim
+// 	Return the frame to evict to make room for a page of "faulting",
+//	or for the pageout daemon if it is NULL; -1 if none can be.  A
+//	process that already has its allotment replaces one of its own
+//	pages, so that it can't take frames from the others.  Otherwise
+//	the process most over its allotment gives up a page.  The
+//	replacement policy picks the page; if the chosen process has
+//	nothing to give, any process's page will do.
+//
+//	A page that would need a swap slot when swap has none left is
+//	passed over, so that a clean page, or one that already has a
+//	slot, is taken instead; -1 is also returned if there is none.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::ChooseVictim(AddrSpace *faulting)
+{
+    AddrSpace *from = NULL;
+    int frame;
+    int *skipped = new int[NumPhysPages];
+    int numSkipped = 0;
+
+    if (faulting != NULL && faulting->pageTable->resident >= faulting->allotment) {
+	from = faulting;
+    } else {
+	int most = 0;
+
+	for (ListIterator<AddrSpace *> it(allSpaces); !it.IsDone(); it.Next()) {
+	    AddrSpace *space = it.Item();
+
+	    if (space->pageTable != NULL
+		&& space->pageTable->resident - space->allotment > most) {
+		most = space->pageTable->resident - space->allotment;
+		from = space;
+	    }
+	}
+    }
+    for (;;) {
+	frame = -1;
+	if (from != NULL) {
+	    frame = kernel->machine->FindVictim(from->pageTable);
+	}
+	if (frame == -1) {
+	    frame = kernel->machine->FindVictim();
+	}
+	if (frame == -1 || PageoutDaemon::CanEvict(frame)) {
+	    break;
+	}
+	//交换区放不下该页：暂时标记为busy，让替换策略另选一页
+	kernel->stats->numEvictions--;		// not evicted after all
+	kernel->machine->GlobalPageTable[frame].busy = TRUE;
+	skipped[numSkipped++] = frame;
+    }
+    for (int i = 0; i < numSkipped; i++) {
+	kernel->machine->GlobalPageTable[skipped[i]].busy = FALSE;
+    }
+    delete [] skipped;
+    return frame;
+}
+
 //----------------------------------------------------------------------
 // AddrSpace::Execute
 // 	Run a user program using the current thread
@@ -277,7 +1285,10 @@ AddrSpace::Execute()
     //this->RestoreState();		// load page table register
     kernel->machine->pageTable = pageTable;
     kernel->machine->pageTableSize = numPages;
-    kernel->machine->FileAddr = FileAddr;
+    AssignASID();
+    kernel->machine->asid = asid;
+    StartCounting();
+    active = TRUE;
 
     kernel->machine->Run();		// jump to the user progam
 
@@ -333,12 +1344,20 @@ AddrSpace::InitRegisters()
 
 void AddrSpace::SaveState() 
 {	
-	cout << "saving state!" << endl;
 	//暂存寄存器内容
 	for (int i=0; i < NumTotalRegs; i++){
 		s_reg[i] = kernel->machine->ReadRegister(i);
 	}
-	cout << "Successfully saving state!" << endl;
+	//记录本次运行期间的性能计数
+	for (int i = 0; i < NumPerfCounters; i++) {
+		perfCounters[i] = ReadCounter((PerfCounterType) i);
+	}
+	//记录工作集，下次运行时读回（挂起时已在Suspend中记录过）
+	if (active) {
+		RecordWorkingSet();
+	}
+	TRACE(dbgAddr, TraceEvents, "saved user registers, PC %d",
+	      s_reg[PCReg]);
 }
 
 //----------------------------------------------------------------------
@@ -351,16 +1370,22 @@ void AddrSpace::SaveState()
 
 void AddrSpace::RestoreState() 
 {
-    cout << "restoring state!" << endl;
     kernel->machine->pageTable = pageTable;
     kernel->machine->pageTableSize = numPages;
-    //也要写入加载程序的元信息
-    kernel->machine->FileAddr = FileAddr;
     //将暂存内容写回寄存器
     for (int i=0; i < NumTotalRegs; i++){
 	kernel->machine->WriteRegister(i, s_reg[i]);
     }
-    cout << "successfully restoring state!" << endl;
+    //TLB项带有地址空间ID，切换时无需清空TLB
+    if (asid < 0) {
+	AssignASID();
+    }
+    kernel->machine->asid = asid;
+    StartCounting();
+    //工作集中被换出的页在下一次缺页时一并读回
+    prefetchPending = (workingSetSize > 0);
+    TRACE(dbgAddr, TraceEvents, "restored user registers, PC %d",
+	  s_reg[PCReg]);
 }
 
 
@@ -384,7 +1409,9 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
         return AddressErrorException;
     }
 
-    pte = &pageTable[vpn];
+    pte = pageTable->Lookup(vpn);
+    if (pte == NULL)
+	return PageFaultException;
 
     if(isReadWrite && pte->readOnly) {
         return ReadOnlyException;
@@ -410,7 +1437,7 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
 
     *paddr = pfn*PageSize + offset;
 
-    ASSERT((*paddr < MemorySize));
+    ASSERT((*paddr < (unsigned) MemorySize));
 
     //cerr << " -- AddrSpace::Translate(): vaddr: " << vaddr <<
     //  ", paddr: " << *paddr << "\n";
@@ -426,3 +1453,288 @@ AddrSpace::Translate(unsigned int vaddr, unsigned int *paddr, int isReadWrite)
 
 
 
+
+//----------------------------------------------------------------------
+// AddrSpace::Checkpoint
+// 	Write what is needed to rebuild this (the current) address space
+//	to the open checkpoint file "fd".  The page table itself is
+//	written by Machine::Checkpoint, and the registers are in the
+//	machine.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Checkpoint(int fd)
+{
+    int counters[NumPerfCounters];
+    int count;
+
+    for (int i = 0; i < NumPerfCounters; i++) {
+	counters[i] = ReadCounter((PerfCounterType) i);
+    }
+    WriteFile(fd, (char *) &numPages, sizeof(numPages));
+    WriteFile(fd, (char *) &mmapStart, sizeof(int));
+    WriteFile(fd, (char *) &mmapEnd, sizeof(int));
+    count = areas->NumAreas();
+    WriteFile(fd, (char *) &count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+	VMArea *area = areas->Get(i);
+	int type = area->type;
+	int writable = area->writable;
+	int nameLength = (area->mappedName == NULL) ? 0 : strlen(area->mappedName) + 1;
+
+	WriteFile(fd, (char *) &type, sizeof(int));
+	WriteFile(fd, (char *) &area->start, sizeof(int));
+	WriteFile(fd, (char *) &area->end, sizeof(int));
+	WriteFile(fd, (char *) &writable, sizeof(int));
+	WriteFile(fd, (char *) &area->offset, sizeof(int));
+	WriteFile(fd, (char *) &area->fileSize, sizeof(int));
+	WriteFile(fd, (char *) &nameLength, sizeof(int));
+	if (nameLength > 0) {
+	    WriteFile(fd, area->mappedName, nameLength);
+	}
+    }
+    WriteFile(fd, (char *) counters, sizeof(counters));
+    WriteFile(fd, (char *) &allotment, sizeof(int));
+    WriteFile(fd, (char *) &lastFaultTime, sizeof(int));
+    WriteFile(fd, (char *) &numFaults, sizeof(int));
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::Restore
+// 	Rebuild the address space from a checkpoint, taking over the
+//	page table Machine::Restore has just read, and make it the one
+//	the machine runs in (as Execute does, the registers are left
+//	alone: they were restored with the machine).
+//----------------------------------------------------------------------
+
+void
+AddrSpace::Restore(int fd)
+{
+    int count;
+
+    pageTable = kernel->machine->pageTable;
+    programFile = kernel->fileSystem->Open(pageTable->diskFile);
+    ASSERT(programFile != NULL);
+    Read(fd, (char *) &numPages, sizeof(numPages));
+    Read(fd, (char *) &mmapStart, sizeof(int));
+    Read(fd, (char *) &mmapEnd, sizeof(int));
+    Read(fd, (char *) &count, sizeof(int));
+    for (int i = 0; i < count; i++) {
+	int type, start, end, writable, offset, fileSize, nameLength;
+	VMArea *area;
+
+	Read(fd, (char *) &type, sizeof(int));
+	Read(fd, (char *) &start, sizeof(int));
+	Read(fd, (char *) &end, sizeof(int));
+	Read(fd, (char *) &writable, sizeof(int));
+	Read(fd, (char *) &offset, sizeof(int));
+	Read(fd, (char *) &fileSize, sizeof(int));
+	Read(fd, (char *) &nameLength, sizeof(int));
+	area = new VMArea((VMAreaType) type, start, end, writable);
+	if (nameLength > 0) {
+	    char *name = new char[nameLength];
+	    OpenFile *file;
+
+	    Read(fd, name, nameLength);
+	    file = kernel->fileSystem->Open(name);
+	    ASSERT(file != NULL);
+	    area->SetBacking(file, offset, fileSize, name);
+	    delete [] name;
+	} else if (type == CodeArea || type == DataArea) {
+	    area->SetBacking(programFile, offset, fileSize, NULL);
+	}
+	areas->Insert(area);
+    }
+    Read(fd, (char *) perfCounters, sizeof(perfCounters));
+    Read(fd, (char *) &allotment, sizeof(int));
+    Read(fd, (char *) &lastFaultTime, sizeof(int));
+    Read(fd, (char *) &numFaults, sizeof(int));
+    active = TRUE;
+    numTextPages = CountTextPages();
+    textFrames = TextFramesFor(pageTable->diskFile, numTextPages);
+    AssignASID();
+    kernel->machine->asid = asid;
+    StartCounting();
+
+    kernel->machine->pageTableSize = numPages;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::StartCounting
+// 	Note the machine's performance counters as this address space
+//	starts running, so that what happens until it is switched out
+//	can be charged to it.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::StartCounting()
+{
+    for (int i = 0; i < NumPerfCounters; i++) {
+	perfStart[i] = kernel->machine->ReadCounter((PerfCounterType) i);
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::ReadCounter
+// 	Return the performance counter "which" for this process alone:
+//	what was counted while it ran before, plus, if it is running,
+//	what has been counted since it was switched in.
+//----------------------------------------------------------------------
+
+int
+AddrSpace::ReadCounter(PerfCounterType which)
+{
+    if (kernel->currentThread->space != this) {
+	return perfCounters[which];
+    }
+    return perfCounters[which]
+	+ kernel->machine->ReadCounter(which) - perfStart[which];
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::PrintCounters
+// 	Print the performance counters of this process.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::PrintCounters()
+{
+    cout << "Process counters: instructions " << ReadCounter(PerfInstructions);
+    cout << ", loads " << ReadCounter(PerfLoads);
+    cout << ", stores " << ReadCounter(PerfStores) << "\n";
+    cout << "TLB misses " << ReadCounter(PerfTLBMisses);
+    cout << ", page faults " << ReadCounter(PerfPageFaults);
+    cout << ", syscalls " << ReadCounter(PerfSyscalls) << "\n";
+    cout << "Ticks: user " << ReadCounter(PerfUserTicks);
+    cout << ", system " << ReadCounter(PerfSystemTicks) << "\n";
+    cout << "Resident pages " << pageTable->resident;
+    cout << ", allotment " << allotment;
+    cout << ", page faults per 1000 instructions "
+	 << numFaults * 1000.0 / max(ReadCounter(PerfInstructions), 1) << "\n";
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::AssignASID
+// 	Give this address space an ID to tag its TLB entries with.  When
+//	all IDs are taken, one is taken away (in turn) from another space,
+//	whose TLB entries are dropped; it gets a new ID when it next runs.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::AssignASID()
+{
+    int i;
+
+    for (i = 0; i < NumASIDs && asidOwner[i] != NULL; i++);
+    if (i == NumASIDs) {
+	i = nextASIDVictim;
+	nextASIDVictim = (nextASIDVictim + 1) % NumASIDs;
+	asidOwner[i]->FlushTLB();
+	asidOwner[i]->asid = -1;
+    }
+    asidOwner[i] = this;
+    asid = i;
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::SaveTLBEntry
+// 	The hardware only sets the use and dirty bits in the TLB, so copy
+//	them to the page table the entry came from before it is dropped.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::SaveTLBEntry(TranslationEntry *entry)
+{
+    AddrSpace *owner = asidOwner[entry->asid];
+
+    if (owner != NULL) {
+	TranslationEntry *pte = owner->pageTable->Lookup(entry->virtualPage);
+
+	pte->use |= entry->use;
+	pte->dirty |= entry->dirty;
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::FlushTLB
+// 	Drop all TLB entries tagged with our address space ID.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::FlushTLB()
+{
+    TranslationEntry *tlb = kernel->machine->tlb;
+
+    if (tlb == NULL || asid < 0) {
+	return;
+    }
+    for (int i = 0; i < TLBSize; i++) {
+	if (tlb[i].valid && tlb[i].asid == asid) {
+	    SaveTLBEntry(&tlb[i]);
+	    tlb[i].valid = FALSE;
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::InvalidateTLB
+// 	Drop the TLB entries, of any address space, that map physical
+//	page "frame" -- e.g. because the page in it is being evicted.
+//	Their use and dirty bits are first copied to the page tables.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::InvalidateTLB(int frame)
+{
+    TranslationEntry *tlb = kernel->machine->tlb;
+
+    if (tlb == NULL) {
+	return;
+    }
+    for (int i = 0; i < TLBSize; i++) {
+	if (tlb[i].valid && tlb[i].physicalPage == frame) {
+	    SaveTLBEntry(&tlb[i]);
+	    tlb[i].valid = FALSE;
+	}
+    }
+}
+
+//----------------------------------------------------------------------
+// AddrSpace::RefillTLB
+// 	Handle a TLB miss on virtual page "vpn", which must be valid in
+//	our page table: load its translation into the set it maps to,
+//	replacing an invalid entry if there is one, and otherwise the
+//	ways of the set in turn.
+//----------------------------------------------------------------------
+
+void
+AddrSpace::RefillTLB(int vpn)
+{
+    TranslationEntry *tlb = kernel->machine->tlb;
+    int numSets = TLBSize / TLBWays;
+    int set = vpn % numSets;
+    TranslationEntry *pte = pageTable->Lookup(vpn);
+    TranslationEntry *entry;
+    int way;
+
+    ASSERT(pte != NULL && pte->valid && asid >= 0);
+    if (nextTLBWay == NULL) {
+	nextTLBWay = new int[numSets];
+	for (int i = 0; i < numSets; i++) {
+	    nextTLBWay[i] = 0;
+	}
+    }
+    for (way = 0; way < TLBWays && tlb[set * TLBWays + way].valid; way++);
+    if (way == TLBWays) {
+	way = nextTLBWay[set];
+	nextTLBWay[set] = (way + 1) % TLBWays;
+    }
+    entry = &tlb[set * TLBWays + way];
+    if (entry->valid) {
+	SaveTLBEntry(entry);
+    }
+    *entry = *pte;
+    entry->asid = asid;
+    TRACE(dbgVm, TraceEvents, "TLB refill: vpn %d, frame %d, set %d",
+	  vpn, entry->physicalPage, set);
+}
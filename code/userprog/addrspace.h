@@ -15,9 +15,31 @@
 
 #include "copyright.h"
 #include "filesys.h"
+#include "vma.h"
 
 #define UserStackSize		1024 	// increase this as necessary!
 
+extern int VirtualPages;		// pages in each virtual address space;
+					// the stack starts at the top.  If 0,
+					// just enough for the program
+extern int DemandPaging;		// if 0, Load gives the program all the
+					// free frames up front
+extern int ReadaheadPages;		// most pages read ahead after a
+					// sequential page fault; 0 disables
+extern int MmapPages;			// pages of each address space kept
+					// for mapped files
+extern int MinResidentPages;		// smallest frame allotment
+extern int FaultIntervalLow;		// a process faulting within this many
+					// instructions of its last fault is
+					// given another frame
+extern int FaultIntervalHigh;		// and one for each this many it went
+					// without a fault is taken away
+extern int ResumePrefetchPages;		// most pages of its working set read
+					// back when a process runs again; 0
+					// disables
+
+class Semaphore;
+
 class AddrSpace {
   public:
     AddrSpace();			// Create an address space.
@@ -34,8 +56,72 @@ class AddrSpace {
     void SaveState();			// Save/restore address space-specific
     void RestoreState();		// info on a context switch 
 
-    //存储当前程序的元信息，如代码和数据的大小和虚拟地址等
-    int* FileAddr;
+    void RefillTLB(int vpn);		// Load the TLB entry for virtual
+					// page "vpn" from our page table
+    static void InvalidateTLB(int frame);
+					// Drop any TLB entry mapping
+					// "frame", keeping its use and
+					// dirty bits
+
+    int ReadCounter(PerfCounterType which);	// Performance counter for this
+					// process alone
+    void PrintCounters();		// Print all of them
+
+    void Checkpoint(int fd);		// Write the address space to a
+    void Restore(int fd);		// checkpoint, or rebuild it from one
+
+    void FillPages(int vpn, int count, int *frames);
+					// Read the initial contents of
+					// "count" virtual pages from "vpn"
+					// into "frames"
+    void FillPage(int vpn, int frame) { FillPages(vpn, 1, &frame); }
+    bool Duplicate(AddrSpace *parent);	// Become a copy-on-write copy of
+					// "parent"; FALSE if out of memory
+    void CopyOnWrite(int vpn, int frame);
+					// Make shared page "vpn" writable,
+					// copying it to "frame" if need be
+
+    bool IsText(int vpn);		// Is page "vpn" all code, and so
+					// shareable with other instances?
+    int FindText(int vpn);		// The frame holding code page "vpn"
+					// for this program, or -1
+    void AddText(int vpn, int frame);	// Offer code page "vpn", just read
+					// into "frame", to other instances
+
+    bool IsWritable(int vpn);		// May page "vpn" be written (unless
+					// it is shared copy-on-write)?
+    VMArea *FaultArea(int addr);	// The area a fault at "addr" is in,
+					// growing the stack down to it if
+					// need be; NULL if there is none
+
+    int Mmap(char *fileName, int offset, int length, bool writable);
+					// Map "length" bytes of a file from
+					// "offset"; return their address,
+					// or -1
+    int Munmap(int addr);		// Remove the mapping at "addr",
+					// writing back its dirty pages
+    static bool WriteBack(PageTable *table, int vpn, int frame);
+					// If page "vpn" of "table" is part
+					// of a mapped file, write "frame"
+					// back to the file and return TRUE
+    static bool IsMapped(PageTable *table, int vpn);
+					// Is page "vpn" of "table" part of
+					// a mapped file?
+
+    void Readahead(int vpn);		// Page "vpn" just faulted in: if the
+					// faults look sequential, bring in
+					// the next few pages too
+
+    void NoteFault();			// We are taking a page fault: adjust
+					// our frame allotment, and suspend
+					// us if memory is overcommitted
+    static int ChooseVictim(AddrSpace *faulting);
+					// The frame to evict for a page
+					// fault of "faulting" (or for the
+					// pageout daemon, if NULL)
+    void PrefetchWorkingSet();		// If we have just been switched back
+					// in, read back the pages we were
+					// last using, all at once
 
     // Translate virtual address _vaddr_
     // to physical address _paddr_. _mode_
@@ -43,14 +129,68 @@ class AddrSpace {
     ExceptionType Translate(unsigned int vaddr, unsigned int *paddr, int mode);
 
   private:
-    TranslationEntry *pageTable;	// Assume linear page table translation
-					// for now!
+    PageTable *pageTable;		// Two-level: only the parts of the
+					// address space in use have tables
     unsigned int numPages;		// Number of pages in the virtual 
 					// address space
+    OpenFile *programFile;		// the program, open for page faults
+    int *textFrames;			// our program's entry in the text
+					// cache: a frame for each code page
+    int numTextPages;			// pages wholly in the code segment,
+					// the ones that can be shared
+    int CountTextPages();		// work it out from our areas
+    VMTable *areas;			// our layout, and where our pages
+					// come from
+    int mmapStart, mmapEnd;		// the addresses kept for mapped
+					// files, between the data and stack
+    void AddSegment(VMAreaType type, int start, int size, int inFileAddr,
+		    bool writable);	// Add an area of the program
+    void UnmapArea(VMArea *area);	// Drop the pages of mapped "area"
+    void WriteArea(VMArea *area, int vpn, int frame);
+					// Write the part of page "vpn" in
+					// "area" from "frame" to its file
+
+    int allotment;			// frames we should have, by the page
+					// fault frequency
+    int lastFaultTime;			// instructions we had run at our
+					// last page fault
+    int numFaults;			// page faults we have taken
+    bool active;			// running, and not suspended
+    Semaphore *resume;			// V'd when we may run again after
+					// being suspended
+    void Suspend();			// Give up all our frames, and wait
+					// until there is room for us again
+    static void ResumeSuspended();	// Let suspended processes run again,
+					// as far as memory allows
+
+    int *workingSet;			// the pages we used most recently,
+    int workingSetSize;			// as of our last context switch
+    bool prefetchPending;		// not yet read back since then
+    void RecordWorkingSet();		// note them down
+
+    int lastFault;			// page that last faulted in
+    int raStart, raEnd;			// pages read ahead after it
+    int raWindow;			// how many to read ahead next time
     
     //寄存器的暂存
     int* s_reg;
 
+    int asid;				// ID tagging our TLB entries, or
+					// -1 if we don't have one now
+    void AssignASID();			// Get an address space ID, taking
+					// one from another space if needed
+    void FlushTLB();			// Drop all our TLB entries
+    static void SaveTLBEntry(TranslationEntry *entry);
+					// Copy the use and dirty bits of a
+					// TLB entry to its page table
+
+    int perfCounters[NumPerfCounters];	// counts while the process ran
+					// up to its last context switch
+    int perfStart[NumPerfCounters];	// machine counters when it was
+					// last switched in
+    void StartCounting();		// take perfStart
+
+
     void InitRegisters();		// Initialize user-level CPU registers,
 					// before jumping to user code
 
@@ -0,0 +1,222 @@
+// compress.cc
+//	Routines to manage the compressed page pool, which keeps evicted
+//	pages in memory, compressed, rather than writing them to the swap
+//	file.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "main.h"
+#include "compress.h"
+
+int CompressedPages = 0;		// see compress.h; a machine parameter
+
+//----------------------------------------------------------------------
+// CompressedPool::CompressedPool
+// 	Set aside the memory for the pool, with every chunk free.
+//
+//	"numPages" -- the size of the pool, in uncompressed pages
+//	"numSlots" -- the number of slots in swap; pages are stored by slot
+//----------------------------------------------------------------------
+
+CompressedPool::CompressedPool(int numPages, int numSlots)
+{
+    int numChunks = divRoundUp(numPages * PageSize, PoolChunkSize);
+
+    memory = new char[numChunks * PoolChunkSize];
+    chunks = new Bitmap(numChunks);
+    chunksPerPage = divRoundUp(PageSize, PoolChunkSize);
+    buffer = new char[PageSize];
+    this->numSlots = numSlots;
+    length = new int[numSlots];
+    chunkList = new int *[numSlots];
+    for (int i = 0; i < numSlots; i++) {
+	length[i] = 0;
+	chunkList[i] = NULL;
+    }
+}
+
+//----------------------------------------------------------------------
+// CompressedPool::~CompressedPool
+// 	Give the pool's memory back; the pages in it are lost.
+//----------------------------------------------------------------------
+
+CompressedPool::~CompressedPool()
+{
+    for (int i = 0; i < numSlots; i++) {
+	delete [] chunkList[i];
+    }
+    delete [] chunkList;
+    delete [] length;
+    delete [] buffer;
+    delete chunks;
+    delete [] memory;
+}
+
+//----------------------------------------------------------------------
+// CompressedPool::Store
+// 	Compress the page at "from" into the pool, as the page for swap
+//	slot "slot", replacing any earlier page for that slot.  Return
+//	FALSE if the page would not save at least a chunk, or if the pool
+//	has no room for it; the caller writes it to the swap file instead,
+//	and the pool no longer has a page for the slot.
+//----------------------------------------------------------------------
+
+bool
+CompressedPool::Store(int slot, char *from)
+{
+    int size, needed;
+
+    ASSERT(slot >= 0 && slot < numSlots);
+    Discard(slot);
+    size = Compress(from, PageSize, buffer, (chunksPerPage - 1) * PoolChunkSize);
+    needed = divRoundUp(size, PoolChunkSize);
+    if (size == -1 || chunks->NumClear() < needed) {
+	kernel->stats->numPoolRejects++;
+	TRACE(dbgVm, TraceEvents, "swap slot %d not kept compressed, size %d",
+	      slot, size);
+	return FALSE;
+    }
+
+    length[slot] = size;
+    chunkList[slot] = new int[needed];
+    for (int i = 0; i < needed; i++) {
+	int chunk = chunks->FindAndSet();
+
+	chunkList[slot][i] = chunk;
+	bcopy(buffer + i * PoolChunkSize, memory + chunk * PoolChunkSize,
+	      min(PoolChunkSize, size - i * PoolChunkSize));
+    }
+    kernel->stats->numPoolStores++;
+    kernel->stats->numPoolBytes += size;
+    TRACE(dbgVm, TraceEvents, "swap slot %d compressed to %d bytes", slot, size);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// CompressedPool::Load
+// 	Decompress the page for swap slot "slot" into "into", and return
+//	TRUE; or return FALSE if the pool has no page for the slot.  The
+//	page stays in the pool, as it would stay in the swap file.
+//----------------------------------------------------------------------
+
+bool
+CompressedPool::Load(int slot, char *into)
+{
+    int size;
+
+    ASSERT(slot >= 0 && slot < numSlots);
+    size = length[slot];
+    if (size == 0) {
+	return FALSE;
+    }
+    for (int i = 0; i * PoolChunkSize < size; i++) {
+	bcopy(memory + chunkList[slot][i] * PoolChunkSize,
+	      buffer + i * PoolChunkSize,
+	      min(PoolChunkSize, size - i * PoolChunkSize));
+    }
+    Decompress(buffer, size, into, PageSize);
+    return TRUE;
+}
+
+//----------------------------------------------------------------------
+// CompressedPool::Discard
+// 	Free the chunks holding the page for swap slot "slot", if the pool
+//	has it.
+//----------------------------------------------------------------------
+
+void
+CompressedPool::Discard(int slot)
+{
+    if (length[slot] == 0) {
+	return;
+    }
+    for (int i = 0; i * PoolChunkSize < length[slot]; i++) {
+	chunks->Clear(chunkList[slot][i]);
+    }
+    delete [] chunkList[slot];
+    chunkList[slot] = NULL;
+    length[slot] = 0;
+}
+
+//----------------------------------------------------------------------
+// CompressedPool::Compress
+// 	Run length encode the "size" bytes at "from" into "into", which
+//	has "room" bytes.  Return the encoded size, or -1 if it doesn't
+//	fit.
+//
+//	The encoding is a series of blocks, each a header byte n followed
+//	by data: for n from 0 to 127, the n+1 bytes that follow are copied
+//	as they are; for n from -1 to -127, the one byte that follows is
+//	repeated 1-n times.  Runs shorter than 3 are left in the copied
+//	blocks, where they cost nothing extra.
+//----------------------------------------------------------------------
+
+int
+CompressedPool::Compress(char *from, int size, char *into, int room)
+{
+    int in = 0, out = 0;
+
+    while (in < size) {
+	int run = 1;
+
+	while (in + run < size && run < 128 && from[in + run] == from[in]) {
+	    run++;
+	}
+	if (run >= 3) {
+	    if (out + 2 > room) {
+		return -1;
+	    }
+	    into[out++] = (char) (1 - run);
+	    into[out++] = from[in];
+	    in += run;
+	} else {
+	    int start = in, count = 0;
+
+	    // copy up to the next run worth encoding
+	    while (in < size && count < 128
+		   && !(in + 2 < size && from[in] == from[in + 1]
+			&& from[in] == from[in + 2])) {
+		in++;
+		count++;
+	    }
+	    if (out + 1 + count > room) {
+		return -1;
+	    }
+	    into[out++] = (char) (count - 1);
+	    bcopy(from + start, into + out, count);
+	    out += count;
+	}
+    }
+    return out;
+}
+
+//----------------------------------------------------------------------
+// CompressedPool::Decompress
+// 	Decode the "size" bytes of run length encoding at "from" (see
+//	Compress) into the "pageSize" bytes at "into".
+//----------------------------------------------------------------------
+
+void
+CompressedPool::Decompress(char *from, int size, char *into, int pageSize)
+{
+    int in = 0, out = 0;
+
+    while (in < size) {
+	int header = (signed char) from[in++];
+
+	if (header >= 0) {
+	    bcopy(from + in, into + out, header + 1);
+	    in += header + 1;
+	    out += header + 1;
+	} else {
+	    for (int i = 0; i < 1 - header; i++) {
+		into[out++] = from[in];
+	    }
+	    in++;
+	}
+    }
+    ASSERT(out == pageSize);
+}
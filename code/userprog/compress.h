@@ -0,0 +1,66 @@
+// compress.h
+//	Data structures for the compressed page pool: a region of kernel
+//	memory, set aside when the kernel starts, holding evicted pages in
+//	compressed form in front of the swap file.
+//
+//	A page written to swap is compressed and kept in the pool if it
+//	shrinks enough and there is room for it; reading it back is then
+//	a decompression, with no wait for the swap device.  A page that
+//	doesn't compress, or doesn't fit, goes to the swap file as
+//	before.  Pages are known by their swap slot, so the pool is
+//	invisible outside the swap area.
+//
+//	The pool is divided into chunks of PoolChunkSize bytes, and a
+//	compressed page takes as many chunks as it needs, wherever they
+//	are, so the pool doesn't fragment.  Pages are compressed by run
+//	length encoding (the PackBits scheme): cheap, and good at the
+//	zero-filled and repetitive pages of data-heavy programs.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "copyright.h"
+#include "bitmap.h"
+
+extern int CompressedPages;		// size of the pool, in pages; 0
+					// means no pool.  A machine parameter
+
+const int PoolChunkSize = 16;		// bytes per chunk of the pool
+
+// The following class defines the compressed page pool.
+
+class CompressedPool {
+  public:
+    CompressedPool(int numPages, int numSlots);
+					// Set aside "numPages" pages of
+					// memory for pages of swap, which
+					// has "numSlots" slots
+    ~CompressedPool();
+
+    bool Store(int slot, char *from);	// Keep a compressed copy of the
+					// page for "slot"; FALSE if it
+					// doesn't compress or fit
+    bool Load(int slot, char *into);	// Decompress the page for "slot";
+					// FALSE if the pool hasn't got it
+    void Discard(int slot);		// Forget the page for "slot", if any
+
+  private:
+    char *memory;			// the pool
+    Bitmap *chunks;			// which chunks are in use
+    int chunksPerPage;			// chunks a page takes uncompressed
+    char *buffer;			// a page being compressed
+
+    int numSlots;
+    int *length;			// compressed size of each slot's
+					// page; 0 if it isn't in the pool
+    int **chunkList;			// the chunks holding it, in order
+
+    static int Compress(char *from, int size, char *into, int room);
+    static void Decompress(char *from, int size, char *into, int pageSize);
+};
+
+#endif // COMPRESS_H
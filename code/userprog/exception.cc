@@ -25,6 +25,70 @@
 #include "main.h"
 #include "syscall.h"
 #include "ksyscall.h"
+#include "swap.h"
+#include "pageout.h"
+//----------------------------------------------------------------------
+// TransferPending
+// 	Return TRUE if some frame is busy, being filled or written to swap
+//	by another thread, so that waiting may make a page evictable.
+//----------------------------------------------------------------------
+
+static bool
+TransferPending()
+{
+    for (int i = 0; i < NumPhysPages; i++) {
+        if (kernel->machine->GlobalPageTable[i].busy) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+//----------------------------------------------------------------------
+// GetFrame
+// 	Find a physical page to hold virtual page "vpn" of the current
+//	address space.  If none is free, evict the page chosen by the
+//	replacement policy (see PageoutDaemon::Evict), waiting for it to
+//	be written to swap if it is dirty.  The frame is recorded as ours
+//	in the global page table, and marked busy until the caller has
+//	filled it and our page table entry and clears the mark.
+//
+//	Return -1 if no page can be evicted, even after waiting for the
+//	transfers in progress: swap is full, and every page in memory
+//	would need a slot.
+//----------------------------------------------------------------------
+
+static int
+GetFrame(int vpn)
+{
+    int phy;
+
+    //实际的替换物理页号
+    phy = kernel->machine->findFreeFrame(vpn, kernel->machine->pageTable);
+
+    //没有空闲的页了：自己换出一页（换页守护线程没能及时腾出空闲页）
+    if (phy == -1) {
+        //待替换的全局页表中的物理页号（按各进程的驻留配额选择）；有页在换入换出中时，等其他线程完成
+        while ((phy = AddrSpace::ChooseVictim(kernel->currentThread->space)) == -1) {
+            if (!TransferPending()) {
+                return -1;
+            }
+            kernel->currentThread->Yield();
+        }
+        PageoutDaemon::Evict(phy);
+        //等待写交换区期间其他线程可能运行过，此时机器的页表已恢复为我们的
+        kernel->machine->InvalidateDecodedPage(phy);
+        //更新全局页表：引用该物理页的地址空间的页表和虚拟页号（空闲页已由findFreeFrame更新）
+        kernel->machine->UseFrame(phy, vpn, kernel->machine->pageTable);
+    }
+    //该物理页即将被重新映射，丢弃指向它的快速翻译
+    kernel->machine->InvalidateFastTLB(phy);
+    kernel->machine->GlobalPageTable[phy].busy = TRUE;
+    //空闲页不多时唤醒换页守护线程
+    kernel->pageout->FrameTaken();
+    return phy;
+}
+
 //----------------------------------------------------------------------
 // ExceptionHandler
 // 	Entry point into the Nachos kernel.  Called when a user program
@@ -186,6 +250,69 @@ ExceptionHandler(ExceptionType which) {
                     ASSERTNOTREACHED();
                     break;
 
+                case SC_Clock:
+                    DEBUG(dbgSys, "Clock\n");
+
+                    /* Return the current cycle counter. */
+                    kernel->machine->WriteRegister(2, (int) SysClock());
+
+                    incrementPC();
+                    return;
+                    ASSERTNOTREACHED();
+                    break;
+
+                case SC_Create:
+                    DEBUG(dbgSys, "Create " << kernel->machine->ReadRegister(4) << "\n");
+
+                    /* Create (or, with the stub file system, empty) the file named at register 4. */
+                    result = SysCreate((int) kernel->machine->ReadRegister(4));
+                    kernel->machine->WriteRegister(2, result);
+
+                    incrementPC();
+                    return;
+                    ASSERTNOTREACHED();
+                    break;
+
+                case SC_Mmap:
+                    DEBUG(dbgSys, "Mmap " << kernel->machine->ReadRegister(4) << ", offset "
+                                          << kernel->machine->ReadRegister(5) << ", length "
+                                          << kernel->machine->ReadRegister(6) << "\n");
+
+                    /* Map the file named at register 4 and return its address in register 2. */
+                    result = SysMmap((int) kernel->machine->ReadRegister(4),
+                                     (int) kernel->machine->ReadRegister(5),
+                                     (int) kernel->machine->ReadRegister(6),
+                                     (int) kernel->machine->ReadRegister(7));
+                    kernel->machine->WriteRegister(2, result);
+
+                    incrementPC();
+                    return;
+                    ASSERTNOTREACHED();
+                    break;
+
+                case SC_Munmap:
+                    DEBUG(dbgSys, "Munmap " << kernel->machine->ReadRegister(4) << "\n");
+
+                    result = SysMunmap((int) kernel->machine->ReadRegister(4));
+                    kernel->machine->WriteRegister(2, result);
+
+                    incrementPC();
+                    return;
+                    ASSERTNOTREACHED();
+                    break;
+
+                case SC_PerfCounter:
+                    DEBUG(dbgSys, "PerfCounter " << kernel->machine->ReadRegister(4) << "\n");
+
+                    /* Read the counter selected by register 4 into register 2. */
+                    result = SysPerfCounter((int) kernel->machine->ReadRegister(4));
+                    kernel->machine->WriteRegister(2, result);
+
+                    incrementPC();
+                    return;
+                    ASSERTNOTREACHED();
+                    break;
+
                 default:
                     cerr << "Unexpected system call " << type << "\n";
                     break;
@@ -193,121 +320,169 @@ ExceptionHandler(ExceptionType which) {
             break;
 
         case PageFaultException:
-            int virAddr, vpn, offset, phy, vir;
-            //磁盘文件
-            OpenFile *out_file, *in_file;
+            int virAddr, vpn, offset, phy, faultStart;
+            //缺页的页表项
+            TranslationEntry *pte;
+            //缺页地址所在的区域
+            VMArea *area;
             //待读取的虚拟entry和待替换的entry
             virAddr = kernel->machine->ReadRegister(BadVAddrReg);
             //虚拟页号
             vpn = virAddr / PageSize;
             //偏移量
             offset = virAddr % PageSize;
-            cout << "virtual address " << virAddr << " with page " << vpn << " offset " << offset
-                 << " triggering a page fault!" << endl << endl;
+            TRACE(dbgVm, TraceEvents, "page fault at %d, vpn %d, offset %d",
+                  virAddr, vpn, offset);
+            //查一次区域表：不属于任何区域（也不是栈的增长）的地址是非法访问
+            area = kernel->currentThread->space->FaultArea(virAddr);
+            if (area == NULL) {
+                cerr << "Access to unmapped address " << virAddr << "\n";
+                ExceptionHandler(AddressErrorException);
+                return;
+            }
+            kernel->stats->numPageFaults++;
+            //按缺页频率调整本进程的驻留配额；内存不够所有进程的配额时，可能在此被挂起
+            kernel->currentThread->space->NoteFault();
+            //缺页处理的耗时（包括等待交换区的时间）计入直方图
+            faultStart = kernel->stats->totalTicks;
+            //重新调度后的第一次缺页：把上次运行时的工作集一次读回
+            kernel->currentThread->space->PrefetchWorkingSet();
+            //页表是两级的，缺页的虚拟页可能还没有二级页表，此时分配
+            pte = kernel->machine->pageTable->Entry(vpn);
+            //缺页的页已随工作集读回
+            if (pte->valid && pte->physicalPage != -1) {
+                kernel->stats->RecordFaultLatency(kernel->stats->totalTicks - faultStart);
+                return;
+            }
 
-            //实际的替换物理页号
-            phy = kernel->machine->findFreeFrame(vpn, kernel->machine->pageTable);
+            //同一程序的其他实例已把这一代码页读入内存：直接只读映射同一物理页
+            phy = kernel->currentThread->space->FindText(vpn);
+            if (phy != -1) {
+                kernel->machine->AddUser(phy, kernel->machine->pageTable);
+                pte->physicalPage = phy;
+                pte->valid = TRUE;
+                pte->use = FALSE;
+                pte->dirty = FALSE;
+                pte->readOnly = TRUE;
+                kernel->stats->numTextShares++;
+                TRACE(dbgVm, TraceEvents, "mapped shared code page vpn %d in frame %d",
+                      vpn, phy);
+                kernel->stats->RecordFaultLatency(kernel->stats->totalTicks - faultStart);
+                return;
+            }
 
-            //没有空闲的页了
+            //找一个物理页（没有空闲的就换出一页）
+            phy = GetFrame(vpn);
             if (phy == -1) {
-                //待替换的全局页表中的物理页号
-                phy = kernel->machine->findFreeByLRU();
-                //待替换的全局页表中的原引用的虚拟页号
-                vir = kernel->machine->GlobalPageTable[phy].VirNum;
+                cerr << "Out of memory: swap is full\n";
+                ExceptionHandler(AddressErrorException);
+                return;
+            }
+
+            if (pte->swapSlot != NoSwapSlot) {
+                //该页曾被换出，直接从交换区读回
+                kernel->swapSpace->ReadPage(pte->swapSlot,
+                                            &(kernel->machine->mainMemory[phy * PageSize]));
+            } else if (area->type == StackArea) {
+                //栈页独占整页，直接填零，无需再查区域表
+                bzero(&(kernel->machine->mainMemory[phy * PageSize]), PageSize);
+            } else {
+                //没有换出过的页从程序文件（或映射的文件）读入：按区域整块读入，其余部分（bss）填零
+                kernel->currentThread->space->FillPage(vpn, phy);
+            }
 
-                cout << "no free frame and choose virtual page " << vir << " memory frame " << phy
-                     << " as replacement by LRU!" << endl;
+            //in_file->ReadAt(&(kernel->machine->mainMemory[phy*PageSize]), PageSize, kernel->machine->pageTable[vpn].virtualPage*PageSize);
+            TRACE(dbgVm, TraceEvents, "read vpn %d into frame %d", vpn, phy);
 
-                //读取程序的名称便于将程序从磁盘读入到内存中
-                char *fileName = kernel->machine->GlobalPageTable[phy].RefPageTable[vir].DiskFile;
+            //更新地址空间的程序页表
+            pte->physicalPage = phy;
+            pte->valid = TRUE;
+            pte->use = FALSE;
+            pte->dirty = FALSE;
+            //代码页和只读映射的文件页只读；代码页还提供给同一程序的其他实例
+            pte->readOnly = !kernel->currentThread->space->IsWritable(vpn);
+            if (kernel->currentThread->space->IsText(vpn)) {
+                kernel->currentThread->space->AddText(vpn, phy);
+            }
 
-                out_file = kernel->fileSystem->Open(fileName);
-                cout << "previous frame will be write back to " << fileName << endl;
+            //页已就绪，可以被换出了
+            kernel->machine->GlobalPageTable[phy].busy = FALSE;
 
-                ASSERT(out_file != NULL)
-                //如果是该Frame被写过，才会写回disk
-                if (kernel->machine->GlobalPageTable[phy].RefPageTable[vir].dirty) {
-                    out_file->WriteAt(&(kernel->machine->mainMemory[phy * PageSize]), PageSize,
-                                      kernel->machine->GlobalPageTable[phy].RefPageTable[vir].virtualPage * PageSize);
-                }
-                cout << "successfully write frame " << phy << " back to disk!" << endl;
-                delete out_file;
+            //顺序缺页时预读其后的若干页（栈向下增长，不预读）
+            if (area->type != StackArea) {
+                kernel->currentThread->space->Readahead(vpn);
             }
-            //else cout << "free memory frame " << phy << " is used to tackle page fault!" << endl;
-            in_file = kernel->fileSystem->Open(kernel->machine->pageTable[vpn].DiskFile);
-            cout << "Opening " << kernel->machine->pageTable[vpn].DiskFile << " !" << endl;
-            ASSERT(in_file != NULL)
-
-            //读取程序的元信息
-            int cVir, cSize, cIn, dVir, dSize, dIn, roVir, roSize, roIn;
-            cVir = kernel->machine->FileAddr[0];
-            cSize = kernel->machine->FileAddr[1];
-            cIn = kernel->machine->FileAddr[2];
-            dVir = kernel->machine->FileAddr[3];
-            dSize = kernel->machine->FileAddr[4];
-            dIn = kernel->machine->FileAddr[5];
-            roVir = kernel->machine->FileAddr[6];
-            roSize = kernel->machine->FileAddr[7];
-            roIn = kernel->machine->FileAddr[8];
-
-            //逐字节将虚拟地址对应的页的内容从磁盘写入内存中找到的物理页中
-            for (int i = 0; i < PageSize; i++) {
-                int vAddr = vpn * PageSize + i;
-                int pAddr = phy * PageSize + i;
-                //如果该数据位于代码段
-                if (vAddr >= cVir && vAddr < (cVir + cSize)) {
-                    //cout << "********code fault!********" << endl;
-                    in_file->ReadAt(&(kernel->machine->mainMemory[pAddr]), 1, cIn + vAddr - cVir); // cIn+vAddr-cVir
-                }//如果在数据段
-                else if (vAddr >= dVir && vAddr < (dVir + dSize)) {
-                    //cout << "********data fault!********" << endl;
-                    in_file->ReadAt(&(kernel->machine->mainMemory[pAddr]), 1, dIn + vAddr - dVir); //-dVir
+            kernel->stats->RecordFaultLatency(kernel->stats->totalTicks - faultStart);
+
+            //打印全局页表（仅在调试时，否则每次缺页都要输出整张表）
+            if (debug->IsEnabled(dbgVm))
+                kernel->machine->printGlbPt();
+            return;
+            ASSERTNOTREACHED();
+            break;
+
+        case ReadOnlyException:
+            //写只读页：如果是写时复制的共享页，复制一份私有的（只剩自己在用时直接接管），
+            //返回后该写操作会重新执行
+            virAddr = kernel->machine->ReadRegister(BadVAddrReg);
+            vpn = (unsigned) virAddr / PageSize;
+            pte = kernel->machine->pageTable->Lookup(vpn);
+            if (pte == NULL || !pte->cow) {
+                cerr << "Write to read-only page at " << virAddr << "\n";
+                break;
+            }
+            phy = pte->physicalPage;
+            //TLB和快速翻译缓存中的是只读的映射，先丢弃
+            AddrSpace::InvalidateTLB(phy);
+            kernel->machine->InvalidateFastTLB(phy);
+            if (kernel->machine->GlobalPageTable[phy].refCount > 1) {
+                int copy;
+
+                copy = GetFrame(vpn);
+                if (copy == -1) {
+                    cerr << "Out of memory: swap is full\n";
+                    ExceptionHandler(AddressErrorException);
+                    return;
+                }
+                //GetFrame可能换出了正要复制的这一页（交换区满时它可能是唯一能换出的页）：
+                //该页已成为我们私有的、在交换区中的页，归还物理页，写操作重新执行时缺页读回
+                if (!pte->valid || pte->physicalPage != phy) {
+                    kernel->machine->GlobalPageTable[copy].busy = FALSE;
+                    kernel->machine->FreeFrame(copy);
+                    return;
                 }
-                    //如果在只读数据段
-                else if (vAddr >= roVir && vAddr < (roVir + roSize)) {
-                    in_file->ReadAt(&(kernel->machine->mainMemory[pAddr]), 1, roIn + vAddr - roVir);
-                } else {
-                    //执行到这里，说明目前发生的缺页的原本目的并非读入程序的代码和数据，而是开辟新的空间用于存储
-                    /*
-                    cout << "**********不能识别的缺页虚拟地址************" << endl;
-                    cout << "虚拟基址: " << virAddr << endl;
-                    cout << "错误虚拟地址: " << vAddr << endl;
-                    if (cSize > 0) cout << "代码段范围: " << cVir << " ," << cVir+cSize << endl;
-                    if (dSize > 0) cout << "数据段范围: " << dVir << " ," << dVir+dSize << endl;
-                    if (roSize > 0) cout << "只读段范围: " << roVir << " ," << roVir+roSize << endl;
-                    cout << "******************************************" << endl;*/
-                    continue;
-                    //ASSERT(FALSE);
+                //GetFrame等待交换区期间，其他共享者可能已经退出或复制走了这一页；
+                //只剩我们在用时直接接管，归还刚拿到的物理页
+                if (kernel->machine->GlobalPageTable[phy].refCount == 1) {
+                    kernel->machine->GlobalPageTable[copy].busy = FALSE;
+                    kernel->machine->FreeFrame(copy);
+                    copy = -1;
                 }
+                kernel->currentThread->space->CopyOnWrite(vpn, copy);
+                if (copy != -1) {
+                    kernel->machine->GlobalPageTable[copy].busy = FALSE;
+                }
+            } else {
+                kernel->currentThread->space->CopyOnWrite(vpn, -1);
             }
+            return;
+            ASSERTNOTREACHED();
+            break;
 
-            //in_file->ReadAt(&(kernel->machine->mainMemory[phy*PageSize]), PageSize, kernel->machine->pageTable[vpn].virtualPage*PageSize);
-            cout << "successfully writing frame " << vpn << " to memory from disk!" << endl;
-
-            //更新全局页表:将旧的的物理地址对应的全局页表项删除，同时更新缺页的虚拟地址信息
-            cout << "global update: previous virtual page " << vir << ", physical page " << phy
-                 << " referencing is invalid!" << endl;
-            //因为该原页的物理地址被占，因此原引用地址空间的页表对应的虚拟页失效
-            if (kernel->machine->GlobalPageTable[phy].RefPageTable != NULL)
-                kernel->machine->GlobalPageTable[phy].RefPageTable[vir].valid = FALSE;
-            //更新的引用该物理页的虚拟页号
-            kernel->machine->GlobalPageTable[phy].VirNum = kernel->machine->pageTable[vpn].virtualPage;
-            //更新的引用该物理页的地址空间的页表
-            kernel->machine->GlobalPageTable[phy].RefPageTable = kernel->machine->pageTable;
-            kernel->machine->GlobalPageTable[phy].useStamp = 0;
-            cout << "new global entry : " << phy << " , " << kernel->machine->pageTable[vpn].virtualPage << endl;
-
-            //更新地址空间的程序页表
-            kernel->machine->pageTable[vpn].physicalPage = phy;
-            kernel->machine->pageTable[vpn].valid = TRUE;
-            kernel->machine->pageTable[vpn].use = FALSE;
-            kernel->machine->pageTable[vpn].dirty = FALSE;
-            kernel->machine->pageTable[vpn].readOnly = FALSE;
-            delete in_file;
-            cout << "page fault exception ends!new GlobalPageTable:" << endl;
-
-            //打印全局页表
-            kernel->machine->printGlbPt();
+        case TLBMissException:
+            //TLB中没有该虚拟页的映射：由内核从当前地址空间的页表中装入
+            virAddr = kernel->machine->ReadRegister(BadVAddrReg);
+            vpn = (unsigned) virAddr / PageSize;
+            if ((unsigned) vpn >= kernel->machine->pageTableSize) {
+                ExceptionHandler(AddressErrorException);
+                return;
+            }
+            //页表中的映射也无效时，先按缺页处理把该页调入内存
+            pte = kernel->machine->pageTable->Lookup(vpn);
+            if (pte == NULL || !pte->valid || pte->physicalPage == -1) {
+                ExceptionHandler(PageFaultException);
+            }
+            kernel->currentThread->space->RefillTLB(vpn);
             return;
             ASSERTNOTREACHED();
             break;
@@ -19,9 +19,60 @@
 
 
 void SysHalt() {
+    if (kernel->currentThread->space != NULL)
+        kernel->currentThread->space->PrintCounters();
     kernel->interrupt->Halt();
 }
 
+unsigned int SysClock() {
+    return kernel->stats->totalTicks;
+}
+
+int SysPerfCounter(int which) {
+    if (which < 0 || which >= NumPerfCounters)
+        return -1;
+    return kernel->currentThread->space->ReadCounter((PerfCounterType) which);
+}
+
+/* Copy the file name at user address "name" into "fileName", which has
+ * room for "size" bytes.  Return FALSE if it can't be read or is too long.
+ */
+bool ReadFileName(int name, char *fileName, int size) {
+    int count = 0;
+    int ch;
+    do {
+        if (!kernel->machine->ReadMem(name, 1, &ch))
+            return FALSE;
+        name++;
+        fileName[count] = (char) ch;
+    } while (ch != '\0' && ++count < size);
+    return ch == '\0';
+}
+
+int SysCreate(int name) {
+    char fileName[128];
+
+    if (!ReadFileName(name, fileName, 128))
+        return -1;
+#ifdef FILESYS_STUB
+    return kernel->fileSystem->Create(fileName) ? 1 : -1;
+#else
+    return kernel->fileSystem->Create(fileName, 0) ? 1 : -1;
+#endif
+}
+
+int SysMmap(int name, int offset, int length, int mode) {
+    char fileName[128];
+
+    if (!ReadFileName(name, fileName, 128) || (mode != RO && mode != RW))
+        return -1;
+    return kernel->currentThread->space->Mmap(fileName, offset, length, mode == RW);
+}
+
+int SysMunmap(int addr) {
+    return kernel->currentThread->space->Munmap(addr);
+}
+
 
 int SysAdd(int op1, int op2) {
     cout << "************************系统调用结果****************" << endl;
@@ -0,0 +1,311 @@
+// pageout.cc
+//	Routines for the pageout daemon, and for evicting a page, which
+//	both the daemon and the page fault handler do.
+//
+//	The daemon runs as an ordinary kernel thread.  Like any thread
+//	waiting for swap, it lets other threads run while its writes are
+//	in progress; frames being written are marked busy in the global
+//	page table so that no one else evicts them meanwhile.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "main.h"
+#include "pageout.h"
+#include "swap.h"
+
+int FreeLowWater = 4;			// see pageout.h; machine parameters
+int FreeHighWater = 8;
+int PrecleanPages = 8;
+
+//----------------------------------------------------------------------
+// PageoutDaemon::PageoutDaemon
+// 	Fork the pageout daemon, which waits until it is needed.  With
+//	FreeLowWater set to 0 there is no daemon, and page faults evict
+//	pages themselves when memory is full.
+//----------------------------------------------------------------------
+
+PageoutDaemon::PageoutDaemon()
+{
+    wakeup = new Semaphore("pageout", 0);
+    running = FALSE;
+    if (FreeLowWater > 0) {
+	Thread *t = new Thread("pageout daemon");
+
+	t->Fork(PageoutDaemon::Daemon, this);
+    }
+}
+
+//----------------------------------------------------------------------
+// PageoutDaemon::~PageoutDaemon
+// 	The daemon is waiting on "wakeup", so, as with the postal worker,
+//	we leave the semaphore lying about rather than delete it from
+//	under the thread.
+//----------------------------------------------------------------------
+
+PageoutDaemon::~PageoutDaemon()
+{
+}
+
+//----------------------------------------------------------------------
+// PageoutDaemon::FrameTaken
+// 	Called after a frame has been taken to hold a page: if fewer than
+//	FreeLowWater frames are left free, wake the daemon up.  It runs
+//	the next time the current thread gives up the CPU.
+//----------------------------------------------------------------------
+
+void
+PageoutDaemon::FrameTaken()
+{
+    if (FreeLowWater > 0 && !running
+	    && kernel->machine->NumFreeFrames() < FreeLowWater) {
+	running = TRUE;
+	wakeup->V();
+    }
+}
+
+//----------------------------------------------------------------------
+// PageoutDaemon::CanEvict
+// 	Return TRUE if the page in "frame" can be evicted with the swap
+//	slots that are free: every user that would write it to swap (see
+//	Evict) either already has a slot for it or can be given one.
+//	Clean pages, and pages of mapped files, need no slot.
+//----------------------------------------------------------------------
+
+bool
+PageoutDaemon::CanEvict(int frame)
+{
+    GlobalEntry *global = &kernel->machine->GlobalPageTable[frame];
+    int needed;
+
+    AddrSpace::InvalidateTLB(frame);	// fold in the dirty bits held there
+    needed = NeedsSlot(global->RefPageTable, global->VirNum);
+    if (!global->sharedText) {
+	for (FrameUser *user = global->sharers; user != NULL; user = user->next) {
+	    needed += NeedsSlot(user->pageTable, user->virtualPage);
+	}
+    }
+    return needed <= kernel->swapSpace->NumFree();
+}
+
+//----------------------------------------------------------------------
+// PageoutDaemon::NeedsSlot
+// 	Return 1 if evicting page "vpn" of "table" would take a new swap
+//	slot, else 0.
+//----------------------------------------------------------------------
+
+int
+PageoutDaemon::NeedsSlot(PageTable *table, int vpn)
+{
+    TranslationEntry *entry = table->Lookup(vpn);
+
+    if (!entry->dirty || entry->swapSlot != NoSwapSlot
+	    || AddrSpace::IsMapped(table, vpn)) {
+	return 0;
+    }
+    return 1;
+}
+
+//----------------------------------------------------------------------
+// PageoutDaemon::Evict
+// 	Take the page held in "frame" out of the page tables of all its
+//	users, and if it was written since it was last in swap, write it
+//	there, allocating it a slot the first time.  A dirty page of a
+//	mapped file is written back to the file instead.  The frame is left
+//	busy, and with no user, so that it is not chosen again while we
+//	wait for the write; the caller either gives it a new page or
+//	frees it.
+//
+//	A shared code page is simply dropped by its other users, who read
+//	it again.  A page shared copy-on-write becomes a private page of
+//	each of its users, written to each one's own slot (as one request
+//	to the device) if it is dirty; none of them shares it any more.
+//
+//	Every user is unmapped, and every slot allocated, before any write
+//	starts, so the page can't change while the writes are in progress.
+//	If a user faults on it meanwhile, it is read back from swap, where
+//	the write has already put it.
+//
+//	The caller must have checked, with CanEvict, that swap has a slot
+//	for every copy that needs one.
+//----------------------------------------------------------------------
+
+void
+PageoutDaemon::Evict(int frame)
+{
+    GlobalEntry *global = &kernel->machine->GlobalPageTable[frame];
+    char *page = &(kernel->machine->mainMemory[frame * PageSize]);
+    int numUsers = global->refCount;
+    PageTable **mapped = new PageTable *[numUsers];
+    int *mappedVpns = new int[numUsers];
+    int *slots = new int[numUsers];
+    int numMapped = 0, numSlots = 0;
+
+    ASSERT(!global->busy && global->RefPageTable != NULL);
+    ASSERT(CanEvict(frame));		// the caller chose it so
+    global->busy = TRUE;
+    //先使指向该物理页的TLB项和快速翻译失效，并把TLB中的脏位写回页表
+    AddrSpace::InvalidateTLB(frame);
+    kernel->machine->InvalidateFastTLB(frame);
+    //丢弃该页的译码缓存：被换出的程序可能正停在从该页翻译的指令块中间，
+    //恢复运行时必须重新取指（从而缺页），不能继续执行已不属于它的物理页
+    kernel->machine->InvalidateDecodedPage(frame);
+
+    TRACE(dbgVm, TraceEvents, "evicting vpn %d from frame %d", global->VirNum, frame);
+
+    //共享的代码页只需从其他实例的页表中撤销（它们的TLB项上面已经按物理页失效）
+    if (global->sharedText) {
+	kernel->machine->UnmapSharers(frame);
+    }
+    //逐个撤销该物理页的使用者（写时复制共享的页有多个）：原引用地址空间的页表对应的虚拟页失效
+    //物理页号也要清除，否则该地址空间销毁时会把已属于别人的物理页当作自己的释放
+    while (global->RefPageTable != NULL) {
+	PageTable *table = global->RefPageTable;
+	int vpn = global->VirNum;
+	TranslationEntry *victim = table->Lookup(vpn);
+
+	if (global->refCount > 1) {
+	    kernel->machine->RemoveUser(frame, table);	// the next takes its place
+	} else {
+	    //该物理页不再属于任何地址空间（等待写交换区期间它们可能被销毁）
+	    table->resident--;
+	    global->RefPageTable = NULL;
+	}
+	victim->valid = FALSE;
+	victim->physicalPage = -1;
+	victim->cow = FALSE;		// each user now has its own copy
+	if (!victim->dirty) {
+	    continue;
+	}
+	victim->dirty = FALSE;
+	//映射文件的脏页写回文件本身，不占用交换区
+	if (AddrSpace::IsMapped(table, vpn)) {
+	    mapped[numMapped] = table;
+	    mappedVpns[numMapped++] = vpn;
+	    continue;
+	}
+	//如果是该Frame被写过，才需要写入交换区（不再写回程序文件，以免破坏可执行文件）
+	//第一次换出时为该页分配交换槽，之后一直使用同一个槽
+	if (victim->swapSlot == NoSwapSlot) {
+	    victim->swapSlot = kernel->swapSpace->Allocate();
+	    ASSERT(victim->swapSlot != NoSwapSlot);	// see CanEvict
+	}
+	slots[numSlots++] = victim->swapSlot;
+	TRACE(dbgVm, TraceEvents, "writing frame %d to swap slot %d",
+	      frame, victim->swapSlot);
+    }
+
+    //先写回映射的文件（使用者缺页时从文件读回），再写交换区
+    //写交换区时会等待设备，此后不能再使用页表项：其所属地址空间可能已经销毁
+    for (int i = 0; i < numMapped; i++) {
+	AddrSpace::WriteBack(mapped[i], mappedVpns[i], frame);
+    }
+    kernel->swapSpace->WriteCopies(numSlots, slots, page);
+    delete [] mapped;
+    delete [] mappedVpns;
+    delete [] slots;
+}
+
+//----------------------------------------------------------------------
+// PageoutDaemon::Daemon
+// 	The body of the daemon thread: each time it is woken up, free
+//	frames up to the high watermark, then pre-clean.
+//
+//	"data" is the PageoutDaemon object
+//----------------------------------------------------------------------
+
+void
+PageoutDaemon::Daemon(void *data)
+{
+    PageoutDaemon *daemon = (PageoutDaemon *) data;
+
+    for (;;) {
+	daemon->wakeup->P();
+	TRACE(dbgVm, TraceEvents, "pageout daemon woken, %d frames free",
+	      kernel->machine->NumFreeFrames());
+	daemon->Reclaim();
+	daemon->Preclean();
+	daemon->running = FALSE;
+    }
+}
+
+//----------------------------------------------------------------------
+// PageoutDaemon::Reclaim
+// 	Evict the pages chosen by the replacement policy, taken first from
+//	the processes holding more than their allotment, and free their
+//	frames, until FreeHighWater frames are free or no more pages can
+//	be evicted for now.
+//----------------------------------------------------------------------
+
+void
+PageoutDaemon::Reclaim()
+{
+    while (kernel->machine->NumFreeFrames() < FreeHighWater) {
+	int frame = AddrSpace::ChooseVictim(NULL);
+
+	if (frame == -1) {
+	    break;		// the rest are busy, or swap is full
+	}
+	Evict(frame);
+	kernel->machine->GlobalPageTable[frame].busy = FALSE;
+	kernel->machine->FreeFrame(frame);
+	kernel->stats->numDaemonReclaims++;
+    }
+}
+
+//----------------------------------------------------------------------
+// PageoutDaemon::Preclean
+// 	Write the dirty pages among the PrecleanPages frames at the head
+//	of the LRU list to swap, and mark them clean, so that evicting
+//	them later needs no write.  The pages stay mapped; one written
+//	again while the write is in progress is simply dirty again.
+//
+//	Each frame is looked at afresh, since while we waited for the
+//	last write it may have been evicted, freed or given a new page.
+//	Pages of mapped files are written back to the file.
+//----------------------------------------------------------------------
+
+void
+PageoutDaemon::Preclean()
+{
+    int *frames = new int[PrecleanPages];
+    int count = kernel->machine->OldestFrames(frames, PrecleanPages);
+
+    for (int i = 0; i < count; i++) {
+	int frame = frames[i];
+	GlobalEntry *global = &kernel->machine->GlobalPageTable[frame];
+	TranslationEntry *entry;
+
+	if (!kernel->machine->Evictable(frame) || global->refCount != 1) {
+	    continue;
+	}
+	AddrSpace::InvalidateTLB(frame);	// its dirty bit may be there
+	entry = global->RefPageTable->Lookup(global->VirNum);
+	if (!entry->dirty) {
+	    continue;
+	}
+	if (AddrSpace::WriteBack(global->RefPageTable, global->VirNum, frame)) {
+	    entry->dirty = FALSE;
+	    kernel->machine->InvalidateFastTLB(frame);
+	    kernel->stats->numPrecleaned++;
+	    continue;
+	}
+	if (entry->swapSlot == NoSwapSlot) {
+	    entry->swapSlot = kernel->swapSpace->Allocate();
+	    if (entry->swapSlot == NoSwapSlot) {
+		break;			// swap is full: leave it to eviction
+	    }
+	}
+	//清除脏位后，之后的写操作必须经过Translate重新设置脏位
+	entry->dirty = FALSE;
+	kernel->machine->InvalidateFastTLB(frame);
+	kernel->stats->numPrecleaned++;
+	TRACE(dbgVm, TraceEvents, "pre-cleaning frame %d to swap slot %d",
+	      frame, entry->swapSlot);
+	kernel->swapSpace->WritePage(entry->swapSlot,
+				     &(kernel->machine->mainMemory[frame * PageSize]));
+    }
+    delete [] frames;
+}
@@ -0,0 +1,64 @@
+// pageout.h
+//	Data structures for the pageout daemon: a kernel thread that keeps
+//	some physical pages free, so that a page fault rarely has to evict
+//	a page itself and wait for it to be written to swap.
+//
+//	The daemon sleeps until a page fault leaves fewer than FreeLowWater
+//	frames free.  It then evicts pages, chosen by the replacement
+//	policy, until FreeHighWater frames are free, and writes back the
+//	dirty pages next in line for eviction, so that evicting them later
+//	costs no write.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef PAGEOUT_H
+#define PAGEOUT_H
+
+#include "copyright.h"
+#include "synch.h"
+#include "translate.h"
+
+extern int FreeLowWater;		// wake the daemon when fewer frames
+					// are free; 0 means no daemon
+extern int FreeHighWater;		// it frees frames up to this many
+extern int PrecleanPages;		// and then writes back dirty pages
+					// among this many next to be evicted
+
+// The following class defines the pageout daemon.  Its thread is forked
+// when the kernel starts, and waits on a semaphore when it has nothing
+// to do.
+
+class PageoutDaemon {
+  public:
+    PageoutDaemon();			// Fork the daemon thread, unless
+					// FreeLowWater is 0
+    ~PageoutDaemon();
+
+    void FrameTaken();			// A frame was just taken from the
+					// free list: wake the daemon if too
+					// few are left
+
+    static void Evict(int frame);	// Take the page in "frame" out of
+					// every page table mapping it,
+					// writing it to swap if it is dirty
+    static bool CanEvict(int frame);	// Is there room in swap for the
+					// page in "frame", if it needs it?
+
+    static void Daemon(void *data);	// The daemon thread: reclaim and
+					// pre-clean whenever woken up
+
+  private:
+    Semaphore *wakeup;			// V'd to start a round of work
+    bool running;			// a round is in progress, or due
+
+    void Reclaim();			// Evict pages until enough are free
+    void Preclean();			// Write back dirty pages about to
+					// be evicted
+    static int NeedsSlot(PageTable *table, int vpn);
+					// Would evicting this page take a
+					// new swap slot?
+};
+
+#endif // PAGEOUT_H
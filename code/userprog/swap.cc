@@ -0,0 +1,315 @@
+// swap.cc
+//	Routines to manage the swap area, where dirty pages of user
+//	programs are written when they are evicted from memory.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "main.h"
+#include "swap.h"
+
+int SwapPages = 1024;			// see swap.h; a machine parameter
+
+//----------------------------------------------------------------------
+// SwapSpace::SwapSpace
+// 	Create the UNIX file simulating the swap device, as big as the
+//	swap area, and mark all of its slots free.  Any swap file left by
+//	an earlier run is overwritten.
+//
+//	"numSlots" -- the number of pages the swap area can hold
+//----------------------------------------------------------------------
+
+SwapSpace::SwapSpace(int numSlots)
+{
+    int zero = 0;
+
+    this->numSlots = numSlots;
+    sprintf(swapName, "SWAP_%d", kernel->hostName);
+    fileno = OpenForWrite(swapName);
+    if (fileno < 0) {
+	cerr << "Can't create the swap device " << swapName << "\n";
+	Abort();
+    }
+    // write at the end of the file, so that reads will not return EOF
+    Lseek(fileno, numSlots * PageSize - sizeof(int), 0);
+    WriteFile(fileno, (char *) &zero, sizeof(int));
+    slots = new Bitmap(numSlots);
+    pool = NULL;
+    if (CompressedPages > 0) {
+	pool = new CompressedPool(CompressedPages, numSlots);
+    }
+    transferDone = new Semaphore("swap transfer", 0);
+    busyUntil = 0;
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::~SwapSpace
+// 	Close the swap device's file and remove it: nothing in it outlives
+//	the kernel.
+//----------------------------------------------------------------------
+
+SwapSpace::~SwapSpace()
+{
+    Close(fileno);
+    Unlink(swapName);
+    delete slots;
+    delete pool;
+    delete transferDone;
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::ReadSlot, SwapSpace::WriteSlot
+// 	Copy a page between memory and slot "slot" of the swap device.
+//	The caller waits for the transfer.
+//----------------------------------------------------------------------
+
+void
+SwapSpace::ReadSlot(int slot, char *into)
+{
+    Lseek(fileno, slot * PageSize, 0);
+    Read(fileno, into, PageSize);
+}
+
+void
+SwapSpace::WriteSlot(int slot, char *from)
+{
+    Lseek(fileno, slot * PageSize, 0);
+    WriteFile(fileno, from, PageSize);
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::Allocate
+// 	Return a free slot, marking it in use, or NoSwapSlot if every
+//	slot is taken.
+//----------------------------------------------------------------------
+
+int
+SwapSpace::Allocate()
+{
+    int slot = slots->FindAndSet();
+
+    if (slot == -1) {
+	return NoSwapSlot;
+    }
+    TRACE(dbgVm, TraceEvents, "swap slot %d allocated, %d free",
+	  slot, slots->NumClear());
+    return slot;
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::Free
+// 	Return "slot" to the free slots, and drop any page the compressed
+//	pool holds for it.
+//----------------------------------------------------------------------
+
+void
+SwapSpace::Free(int slot)
+{
+    ASSERT(slot >= 0 && slot < numSlots && slots->Test(slot));
+    slots->Clear(slot);
+    if (pool != NULL) {
+	pool->Discard(slot);
+    }
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::Copy
+// 	Allocate a slot and copy the page in "slot" to it, e.g. for a
+//	copy of an address space.  Return the new slot, or NoSwapSlot
+//	if swap is full.
+//----------------------------------------------------------------------
+
+int
+SwapSpace::Copy(int slot)
+{
+    char *page;
+    int copy = Allocate();
+
+    if (copy == NoSwapSlot) {
+	return NoSwapSlot;
+    }
+    page = new char[PageSize];
+    ReadPage(slot, page);
+    WritePage(copy, page);
+    delete [] page;
+    return copy;
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::WritePage, SwapSpace::ReadPage
+// 	Copy one page between memory and swap slot "slot", and wait for
+//	the device to take its time over it.  The copy is made when the
+//	transfer starts, so a page being written may be changed (or
+//	read back) while the writer waits.
+//
+//	A page kept in the compressed pool goes no further, and one read
+//	back from it needs no transfer.  A page written to the device is
+//	dropped from the pool, which would otherwise hold an older copy.
+//----------------------------------------------------------------------
+
+void
+SwapSpace::WritePage(int slot, char *from)
+{
+    ASSERT(slots->Test(slot));
+    if (pool != NULL && pool->Store(slot, from)) {
+	return;
+    }
+    WriteSlot(slot, from);
+    kernel->stats->numSwapWrites++;
+    WaitForTransfer(1);
+}
+
+void
+SwapSpace::ReadPage(int slot, char *into)
+{
+    ASSERT(slots->Test(slot));
+    if (pool != NULL && pool->Load(slot, into)) {
+	kernel->stats->numPoolHits++;
+	return;
+    }
+    ReadSlot(slot, into);
+    kernel->stats->numSwapReads++;
+    WaitForTransfer(1);
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::ReadPages
+// 	Read the pages in the "count" slots "which" into the buffers
+//	"into", as one request to the device: the transfers are queued
+//	together, and the caller waits once, until the last is done,
+//	instead of once per page.
+//----------------------------------------------------------------------
+
+void
+SwapSpace::ReadPages(int count, int *which, char **into)
+{
+    int transfers = 0;
+
+    for (int i = 0; i < count; i++) {
+	ASSERT(slots->Test(which[i]));
+	if (pool != NULL && pool->Load(which[i], into[i])) {
+	    kernel->stats->numPoolHits++;
+	    continue;
+	}
+	ReadSlot(which[i], into[i]);
+	kernel->stats->numSwapReads++;
+	transfers++;
+    }
+    if (transfers > 0) {
+	WaitForTransfer(transfers);
+    }
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::WriteCopies
+// 	Write the page at "from" to each of the "count" slots "which", as
+//	one request to the device, waiting once until the last transfer
+//	is done.  Used to evict a page shared copy-on-write, which each of
+//	its users keeps a copy of.  As with WritePage, the copies are made
+//	before we wait.
+//----------------------------------------------------------------------
+
+void
+SwapSpace::WriteCopies(int count, int *which, char *from)
+{
+    int transfers = 0;
+
+    for (int i = 0; i < count; i++) {
+	ASSERT(slots->Test(which[i]));
+	if (pool != NULL && pool->Store(which[i], from)) {
+	    continue;
+	}
+	WriteSlot(which[i], from);
+	kernel->stats->numSwapWrites++;
+	transfers++;
+    }
+    if (transfers > 0) {
+	WaitForTransfer(transfers);
+    }
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::WaitForTransfer
+// 	Queue a transfer of "numPages" pages behind those already in
+//	progress, and sleep until the device interrupts to say it is
+//	done.  The transfers finish in the order they were queued, as do
+//	the waiters on transferDone.
+//----------------------------------------------------------------------
+
+void
+SwapSpace::WaitForTransfer(int numPages)
+{
+    int now = kernel->stats->totalTicks;
+
+    if (SwapTime == 0) {
+	return;
+    }
+    busyUntil = max(busyUntil, now) + SwapTime * numPages;
+    kernel->interrupt->Schedule(this, busyUntil - now, SwapInt);
+    transferDone->P();
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::CallBack
+// 	The swap device has finished a transfer: wake up the thread
+//	waiting for it.
+//----------------------------------------------------------------------
+
+void
+SwapSpace::CallBack()
+{
+    transferDone->V();
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::Checkpoint
+// 	Write the slots in use, and what they hold, to the open checkpoint
+//	file "fd"; the page tables saved with the checkpoint refer to them
+//	by number.  Pages in the compressed pool are saved uncompressed.
+//----------------------------------------------------------------------
+
+void
+SwapSpace::Checkpoint(int fd)
+{
+    char *page = new char[PageSize];
+    int end = -1;
+
+    for (int i = 0; i < numSlots; i++) {
+	if (slots->Test(i)) {
+	    if (pool == NULL || !pool->Load(i, page)) {
+		ReadSlot(i, page);
+	    }
+	    WriteFile(fd, (char *) &i, sizeof(int));
+	    WriteFile(fd, page, PageSize);
+	}
+    }
+    WriteFile(fd, (char *) &end, sizeof(int));
+    delete [] page;
+}
+
+//----------------------------------------------------------------------
+// SwapSpace::Restore
+// 	Read back the slots written by Checkpoint, onto the swap device.
+//	Every slot starts out free, and the pool empty.
+//----------------------------------------------------------------------
+
+void
+SwapSpace::Restore(int fd)
+{
+    char *page = new char[PageSize];
+    int slot;
+
+    for (;;) {
+	Read(fd, (char *) &slot, sizeof(int));
+	if (slot < 0) {
+	    break;
+	}
+	ASSERT(slot < numSlots && !slots->Test(slot));
+	Read(fd, page, PageSize);
+	slots->Mark(slot);
+	WriteSlot(slot, page);
+    }
+    delete [] page;
+}
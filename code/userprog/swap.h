@@ -0,0 +1,87 @@
+// swap.h
+//	Data structures for the swap area: a device holding the pages of
+//	user programs that have been evicted from memory while dirty.
+//
+//	The swap device is a disk of its own, kept apart from the Nachos
+//	file system (which is far too small to hold it) and simulated,
+//	like the disk, by a UNIX file, SWAP_<host>.  It is divided into
+//	page-sized slots.  A bitmap records which slots are in use; the
+//	page table entry of a page that has a copy in swap holds its slot
+//	number.
+//
+//	The device has a latency: each page transferred takes SwapTime
+//	ticks, one transfer at a time, and the thread asking for it waits
+//	until it is done.  Other threads run meanwhile.
+//
+//	With a compressed page pool (see compress.h), pages that compress
+//	well are kept in memory instead, and cost no transfer.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef SWAP_H
+#define SWAP_H
+
+#include "copyright.h"
+#include "bitmap.h"
+#include "callback.h"
+#include "synch.h"
+#include "compress.h"
+
+extern int SwapPages;			// slots on the swap device; a machine
+					// parameter
+
+const int NoSwapSlot = -1;		// the page has no copy in swap
+
+// The following class defines the swap area.  The swap device is set up
+// when the kernel starts and stays until it halts.
+
+class SwapSpace : public CallBackObj {
+  public:
+    SwapSpace(int numSlots);		// Create the swap device, with
+					// "numSlots" slots all free
+    ~SwapSpace();			// Close and remove it
+
+    int Allocate();			// Return a free slot, or NoSwapSlot
+					// if swap is full
+    void Free(int slot);		// Give a slot back
+    int Copy(int slot);			// Return a new slot holding what
+					// "slot" holds, or NoSwapSlot
+
+    void WritePage(int slot, char *from);
+					// Copy a page of memory to a slot
+    void ReadPage(int slot, char *into);
+					// and back, waiting for the device
+					// unless the pool has the page
+    void ReadPages(int count, int *which, char **into);
+					// Read several pages, waiting once
+					// for all of them
+    void WriteCopies(int count, int *which, char *from);
+					// Copy one page to several slots,
+					// waiting once for all of them
+
+    int NumFree() { return slots->NumClear(); }
+
+    void Checkpoint(int fd);		// Write the slots in use to a
+    void Restore(int fd);		// checkpoint, or read them back
+
+  private:
+    char swapName[32];			// name of the UNIX file simulating
+					// the swap device
+    int fileno;				// UNIX file number of it
+    void ReadSlot(int slot, char *into);	// transfer a page to or
+    void WriteSlot(int slot, char *from);	// from the device
+    Bitmap *slots;			// which slots are in use
+    int numSlots;
+    CompressedPool *pool;		// pages kept compressed in memory,
+					// or NULL if there is no pool
+
+    Semaphore *transferDone;		// V'd as each transfer finishes
+    int busyUntil;			// when the last transfer queued
+					// will finish
+    void WaitForTransfer(int numPages);	// queue a transfer and wait for it
+    void CallBack();			// the device finished a transfer
+};
+
+#endif // SWAP_H
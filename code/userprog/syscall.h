@@ -39,9 +39,22 @@
 #define SC_getThreadID  18
 #define SC_Ipc          19
 #define SC_Clock        20
+#define SC_PerfCounter  21
+#define SC_Mmap         22
+#define SC_Munmap       23
 
 #define SC_Add		42
 
+/* performance counters that can be read with PerfCounter */
+#define PERF_INSTRUCTIONS	0	/* instructions retired */
+#define PERF_LOADS		1	/* loads issued */
+#define PERF_STORES		2	/* stores issued */
+#define PERF_TLB_MISSES		3	/* TLB misses */
+#define PERF_PAGE_FAULTS	4	/* page faults */
+#define PERF_SYSCALLS		5	/* system calls */
+#define PERF_USER_TICKS		6	/* ticks spent running user code */
+#define PERF_SYSTEM_TICKS	7	/* ticks spent in the kernel */
+
 #ifndef IN_ASM
 
 /* The system call interface.  These are the operations the Nachos
@@ -211,6 +224,27 @@ void Ipc(int sendDescriptor, SpaceId r_space, ThreadId r_thread,
  */
 unsigned int Clock();
 
+/*
+ * Returns the value of the performance counter "which" (one of the
+ * PERF_ numbers above) for the calling process, or -1 if there is no
+ * such counter.
+ */
+int PerfCounter(int which);
+
+/* Map "length" bytes of the Nachos file "name", starting at byte
+ * "offset", into the address space, and return the address the first
+ * byte appears at, or -1 on failure.  "mode" is RO or RW.  Pages are
+ * read from the file when first touched; with RW, pages that are
+ * written go back to the file when the system evicts them, on Munmap,
+ * or when the program exits.
+ */
+int Mmap(char *name, int offset, int length, int mode);
+
+/* Remove the mapping made by Mmap at address "addr", writing back the
+ * pages that were written.  Return 0, or -1 if nothing is mapped there.
+ */
+int Munmap(int addr);
+
 #endif /* IN_ASM */
 
 #endif /* SYSCALL_H */
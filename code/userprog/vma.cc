@@ -0,0 +1,205 @@
+// vma.cc
+//	Routines to manage the virtual memory areas of an address space,
+//	and the sorted table holding them.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#include "copyright.h"
+#include "main.h"
+#include "vma.h"
+
+//----------------------------------------------------------------------
+// VMArea::VMArea
+// 	Describe an area of an address space, filled with zeroes until
+//	given a backing file.
+//
+//	"type" -- what the area holds
+//	"start", "end" -- its virtual addresses, [start, end)
+//	"writable" -- whether the program may write the area
+//----------------------------------------------------------------------
+
+VMArea::VMArea(VMAreaType type, int start, int end, bool writable)
+{
+    ASSERT(start <= end);
+    this->type = type;
+    this->start = start;
+    this->end = end;
+    this->writable = writable;
+    file = NULL;
+    offset = 0;
+    fileSize = 0;
+    mappedName = NULL;
+}
+
+//----------------------------------------------------------------------
+// VMArea::~VMArea
+// 	A mapped file is closed with its area; the program file belongs
+//	to the address space.
+//----------------------------------------------------------------------
+
+VMArea::~VMArea()
+{
+    if (mappedName != NULL) {
+	delete file;
+	delete [] mappedName;
+    }
+}
+
+//----------------------------------------------------------------------
+// VMArea::SetBacking
+// 	Say where the contents of the area come from: its first "size"
+//	bytes are in "file" from "offset" on.  If "mappedName" is not
+//	NULL, the area is a mapped file: it keeps the name, and closes
+//	"file" when deleted.
+//----------------------------------------------------------------------
+
+void
+VMArea::SetBacking(OpenFile *file, int offset, int size, char *mappedName)
+{
+    ASSERT(size <= end - start);
+    this->file = file;
+    this->offset = offset;
+    fileSize = size;
+    if (mappedName != NULL) {
+	this->mappedName = new char[strlen(mappedName) + 1];
+	strcpy(this->mappedName, mappedName);
+    }
+}
+
+//----------------------------------------------------------------------
+// VMTable::VMTable
+// 	Initialize an empty table of areas.
+//----------------------------------------------------------------------
+
+VMTable::VMTable()
+{
+    maxAreas = 8;
+    numAreas = 0;
+    areas = new VMArea *[maxAreas];
+}
+
+//----------------------------------------------------------------------
+// VMTable::~VMTable
+// 	Delete the table, and every area still in it.
+//----------------------------------------------------------------------
+
+VMTable::~VMTable()
+{
+    for (int i = 0; i < numAreas; i++) {
+	delete areas[i];
+    }
+    delete [] areas;
+}
+
+//----------------------------------------------------------------------
+// VMTable::Insert
+// 	Add "area" to the table, in address order, doubling the table if
+//	it is full.  Empty areas are not allowed, nor overlapping ones.
+//----------------------------------------------------------------------
+
+void
+VMTable::Insert(VMArea *area)
+{
+    int i = FirstEndingAfter(area->start);
+
+    ASSERT(area->start < area->end);
+    ASSERT(i == numAreas || areas[i]->start >= area->end);
+    if (numAreas == maxAreas) {
+	VMArea **bigger = new VMArea *[maxAreas * 2];
+
+	for (int j = 0; j < numAreas; j++) {
+	    bigger[j] = areas[j];
+	}
+	delete [] areas;
+	areas = bigger;
+	maxAreas *= 2;
+    }
+    for (int j = numAreas; j > i; j--) {
+	areas[j] = areas[j - 1];
+    }
+    areas[i] = area;
+    numAreas++;
+}
+
+//----------------------------------------------------------------------
+// VMTable::Remove
+// 	Take "area" out of the table.  The caller deletes it.
+//----------------------------------------------------------------------
+
+void
+VMTable::Remove(VMArea *area)
+{
+    int i = FirstEndingAfter(area->start);
+
+    ASSERT(i < numAreas && areas[i] == area);
+    for (numAreas--; i < numAreas; i++) {
+	areas[i] = areas[i + 1];
+    }
+}
+
+//----------------------------------------------------------------------
+// VMTable::FirstEndingAfter
+// 	Return the index of the first area whose end is after "addr" --
+//	the one holding "addr", if any does, or else the next one up.
+//	Since areas don't overlap, their ends are sorted too, and a
+//	binary search finds it.
+//----------------------------------------------------------------------
+
+int
+VMTable::FirstEndingAfter(int addr)
+{
+    int low = 0, high = numAreas;
+
+    while (low < high) {
+	int middle = (low + high) / 2;
+
+	if (areas[middle]->end > addr) {
+	    high = middle;
+	} else {
+	    low = middle + 1;
+	}
+    }
+    return low;
+}
+
+//----------------------------------------------------------------------
+// VMTable::Find
+// 	Return the area holding virtual address "addr", or NULL if it is
+//	in none.
+//----------------------------------------------------------------------
+
+VMArea *
+VMTable::Find(int addr)
+{
+    int i = FirstEndingAfter(addr);
+
+    if (i < numAreas && areas[i]->start <= addr) {
+	return areas[i];
+    }
+    return NULL;
+}
+
+//----------------------------------------------------------------------
+// VMTable::FindGap
+// 	Return the lowest page-aligned address from "low" on where "size"
+//	bytes fit below "high" without sharing a page with any area, or
+//	-1 if there is none.
+//----------------------------------------------------------------------
+
+int
+VMTable::FindGap(int size, int low, int high)
+{
+    int addr = divRoundUp(low, PageSize) * PageSize;
+
+    for (int i = FirstEndingAfter(addr); i < numAreas; i++) {
+	int areaStart = divRoundDown(areas[i]->start, PageSize) * PageSize;
+
+	if (areaStart >= addr + size) {
+	    break;
+	}
+	addr = divRoundUp(areas[i]->end, PageSize) * PageSize;
+    }
+    return (addr + size <= high) ? addr : -1;
+}
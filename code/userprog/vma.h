@@ -0,0 +1,89 @@
+// vma.h
+//	Data structures describing the layout of an address space: its
+//	virtual memory areas, and a table of them sorted by address.
+//
+//	An area is a range of virtual addresses with a type, permission
+//	and backing.  Some of an area may be backed by a file, from which
+//	its pages are read the first time they are touched; the rest is
+//	filled with zeroes.  Addresses in no area are not part of the
+//	address space, except just below the stack, which grows down.
+//
+//	Areas never overlap, but since the program's segments need not
+//	start on page boundaries, a page may be shared by two of them.
+//
+// Copyright (c) 1992-1996 The Regents of the University of California.
+// All rights reserved.  See copyright.h for copyright notice and limitation
+// of liability and disclaimer of warranty provisions.
+
+#ifndef VMA_H
+#define VMA_H
+
+#include "copyright.h"
+#include "filesys.h"
+
+// The kinds of area, by what they hold and where it comes from.
+
+enum VMAreaType {
+    CodeArea,				// program code, from the program file
+    DataArea,				// initialized data, from the program
+    ZeroArea,				// uninitialized data, zero-filled
+    StackArea,				// the stack, zero-filled; grows down
+    MappedArea				// a file mapped by Mmap
+};
+
+// The following class defines a virtual memory area.
+
+class VMArea {
+  public:
+    VMArea(VMAreaType type, int start, int end, bool writable);
+					// An area of addresses [start, end)
+					// filled with zeroes
+    ~VMArea();				// Close a mapped file
+
+    void SetBacking(OpenFile *file, int offset, int size, char *mappedName);
+					// The first "size" bytes of the area
+					// come from "file" at "offset"; a
+					// mapped file's name is kept, and
+					// the area owns it
+
+    VMAreaType type;
+    int start, end;			// virtual addresses [start, end)
+    bool writable;			// may the program write the area?
+
+    OpenFile *file;			// the backing file, or NULL
+    int offset;				// where "start" is in the file
+    int fileSize;			// bytes of the area in the file
+    char *mappedName;			// the file's name, for MappedArea
+};
+
+// The following class defines the table of an address space's areas,
+// kept sorted by address so that the area holding an address is found
+// by binary search.
+
+class VMTable {
+  public:
+    VMTable();				// An empty table
+    ~VMTable();				// Delete the table and its areas
+
+    void Insert(VMArea *area);		// Add "area"; it mustn't overlap
+					// any other
+    void Remove(VMArea *area);		// Take "area" out (not deleting it)
+
+    VMArea *Find(int addr);		// The area holding "addr", or NULL
+    int FirstEndingAfter(int addr);	// Index of the first area ending
+					// after "addr" (NumAreas() if none)
+    int FindGap(int size, int low, int high);
+					// Lowest page-aligned address in
+					// [low, high) with "size" bytes
+					// free of areas, or -1
+
+    int NumAreas() { return numAreas; }
+    VMArea *Get(int i) { return areas[i]; }	// In address order
+
+  private:
+    VMArea **areas;			// sorted by start address
+    int numAreas;
+    int maxAreas;			// room in "areas"
+};
+
+#endif // VMA_H